@@ -342,10 +342,9 @@ classdef Polytope < handle
       function reorder(o)
          % Reorder vertices such that cholesky has better sparsity pattern
          
-         % compute the cost of chol decomposition
-         function s = cholCost(H, P)
-            count = symbfact(H(P,P));
-            s = sum(count.^2);
+         % compute the cost of chol decomposition from the column counts
+         function s = cholCost(P)
+            s = MexSolver.analyze(o.A(P,:), 0).flopsChol;
          end
          
          m = size(o.A,1);
@@ -353,7 +352,7 @@ classdef Polytope < handle
          
          p_dissect = dissect(H); p_amd = amd(H);
          
-         if (cholCost(H, p_dissect) < cholCost(H, p_amd))
+         if (cholCost(p_dissect) < cholCost(p_amd))
             p = p_dissect;
          else
             p = p_amd;
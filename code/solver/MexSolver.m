@@ -5,19 +5,52 @@ classdef MexSolver < handle
       w = NaN
       w_solve = NaN
       precision
+      ordering = 0 % 0 = natural, 1 = amd, 2 = nested dissection
+      postorder = false % relabel the rows by a postorder of the elimination tree after the ordering
+      symbolicFile = '' % file of the symbolic analysis, memory mapped if it exists and written otherwise
+      threads = 1
+      laneGroups = false % the threads factorize groups of lanes of w instead of subtrees
+      cholMethod = 0 % 0 = left looking, 1 = supernodal, 2 = multifrontal, 3 = up looking, 4 = auto (supernodal if scratchDir is set)
+      mixedPrecision = false
+      fusedAssembly = true % chol assembles the columns of A W A' instead of storing it
+      pivotTolerance = 0 % pivots <= pivotTolerance * H_jj are replaced (0 = clip only non-positive pivots)
+      useUpdate = false % setScale updates the factor by low-rank changes when few weights change instead of refactoring
+      scratchDir = '' % directory of the scratch files holding the factors out of core ('' = in memory)
       
       % private
       uid
       initialized = false
       accuracy
+      perturbedPivots
       solver
       k
    end
    
    methods (Static)
       function o = loadobj(s)
-         s.uid = s.solver('init', uint64(randi(2^32-1,'uint32')), s.A);
+         s.uid = s.init();
          s.solver('setAccuracyTarget', s.uid, s.precision);
+         if s.threads > 1
+            s.solver('setThreads', s.uid, s.threads);
+         end
+         if s.cholMethod ~= 0
+            s.solver('setCholMethod', s.uid, s.cholMethod);
+         end
+         if s.laneGroups
+            s.solver('setLaneGroups', s.uid, 1);
+         end
+         if s.mixedPrecision
+            s.solver('setMixedPrecision', s.uid, 1);
+         end
+         if ~s.fusedAssembly
+            s.solver('setFusedAssembly', s.uid, 0);
+         end
+         if s.pivotTolerance ~= 0
+            s.solver('setPivotTolerance', s.uid, s.pivotTolerance);
+         end
+         if ~isempty(s.scratchDir)
+            s.solver('setScratchDirectory', s.uid, char(s.scratchDir));
+         end
          if ~any(isnan(s.w))
             w = s.w; s.w = NaN;
             s.setScale(w);
@@ -25,6 +58,19 @@ classdef MexSolver < handle
          o = s;
       end
       
+      % predict the cost of a solver for A from the column counts of L without factorizing
+      % the flops are per lane and the memory is bytesIndex + k * bytesPerLane
+      % nnzL counts the entries L stores with cholMethod (auto counts as supernodal)
+      function s = analyze(A, ordering, postorder, cholMethod)
+         if nargin < 2, ordering = 0; end
+         if nargin < 3, postorder = false; end
+         if nargin < 4, cholMethod = 0; end
+         solver = str2func(MexSolver.solverName(0));
+         r = solver('analyze', uint64(0), A, ordering, double(postorder), cholMethod);
+         s = struct('nnzH', r(1), 'nnzL', r(2), 'flopsChol', r(3), 'flopsProjinv', r(4), ...
+            'flopsSolve', r(5), 'bytesPerLane', r(6), 'bytesIndex', r(7));
+      end
+      
       function func_name = solverName(simd_len)
          if ismac()
             [~,result] = system('sysctl -n machdep.cpu.brand_string');
@@ -55,11 +101,20 @@ classdef MexSolver < handle
    
    methods
       % precision is either double or doubledouble
-      function o = MexSolver(A, precision, k)
+      % ordering is the fill-reducing ordering used inside the solver (natural by default, see Polytope.reorder)
+      % postorder additionally relabels the rows by a postorder of the elimination tree
+      % symbolicFile stores the symbolic analysis to share it among processes and restarts
+      function o = MexSolver(A, precision, k, ordering, postorder, symbolicFile)
+         if nargin < 4, ordering = 0; end
+         if nargin < 5, postorder = false; end
+         if nargin < 6, symbolicFile = ''; end
          o.A = A;
          o.k = k;
+         o.ordering = ordering;
+         o.postorder = postorder;
+         o.symbolicFile = symbolicFile;
          o.solver = str2func(MexSolver.solverName(k));
-         o.uid = o.solver('init', uint64(randi(2^32-1,'uint32')), A);
+         o.uid = o.init();
          o.solver('setAccuracyTarget', o.uid, precision);
          o.precision = precision;
          
@@ -73,6 +128,21 @@ classdef MexSolver < handle
          end
       end
       
+      function uid = init(o)
+         uid = uint64(randi(2^32-1,'uint32'));
+         if isempty(o.symbolicFile)
+            uid = o.solver('init', uid, o.A, o.ordering, double(o.postorder));
+         else
+            uid = o.solver('init', uid, o.A, o.ordering, double(o.postorder), char(o.symbolicFile));
+         end
+      end
+      
+      % write the symbolic analysis, including the kernel selected after the first decompositions
+      function saveSymbolic(o, file)
+         if nargin < 2, file = o.symbolicFile; end
+         o.solver('saveSymbolic', o.uid, char(file));
+      end
+      
       function b = saveobj(a)
          b = a;
          b.uid = [];
@@ -87,7 +157,11 @@ classdef MexSolver < handle
       function setScale(o, w)
          o.initialized = true;
          if ~all(w == o.w, 'all')
-            o.accuracy = o.solver('decompose', o.uid, w);
+            if any(isnan(o.w), 'all') || ~o.useUpdate
+               [o.accuracy, o.perturbedPivots] = o.solver('decompose', o.uid, w);
+            else
+               [o.accuracy, o.perturbedPivots] = o.solver('update', o.uid, o.w, w);
+            end
             o.w = w;
          end
          
@@ -115,6 +189,90 @@ classdef MexSolver < handle
          sigma = o.solver('leverageScoreComplement', o.uid, nSketch);
       end
       
+      % number of threads used in decompose
+      function setThreads(o, threads)
+         o.threads = threads;
+         o.solver('setThreads', o.uid, threads);
+      end
+      
+      % split the lanes of w into groups factorized by separate threads (see setThreads)
+      % this needs k >= 8 (a multiple of 4) and keeps a second copy of the values of the factor
+      % each task copies its lanes back into the factor serially, which costs one pass over L per group
+      function setLaneGroups(o, on)
+         o.solver('setLaneGroups', o.uid, double(on));
+         o.laneGroups = on;
+      end
+      
+      % numeric kernel used in decompose (left looking by default)
+      % 4 times every kernel during the next decompose calls and keeps the fastest, which costs
+      % one symbolic analysis per kernel and a second factor while the kernels are timed
+      function setCholMethod(o, method)
+         o.cholMethod = method;
+         o.solver('setCholMethod', o.uid, method);
+         if ~any(isnan(o.w))
+            w = o.w; o.w = NaN;
+            o.setScale(w);
+         end
+      end
+      
+      % factorize in single precision and refine approxSolve in double
+      % meant for solve only phases: logdet, diagL, L and the leverage scores factorize in double on top of it
+      % accuracy is 0 after setScale as the solves are refined to the working precision
+      function setMixedPrecision(o, mixed)
+         o.mixedPrecision = mixed;
+         o.solver('setMixedPrecision', o.uid, double(mixed));
+         if ~any(isnan(o.w))
+            w = o.w; o.w = NaN;
+            o.setScale(w);
+         end
+      end
+      
+      % false stores the lower triangle of A W A' and factors it, instead of assembling its columns inside chol
+      function setFusedAssembly(o, fused)
+         o.fusedAssembly = fused;
+         o.solver('setFusedAssembly', o.uid, double(fused));
+         if ~any(isnan(o.w))
+            w = o.w; o.w = NaN;
+            o.setScale(w);
+         end
+      end
+      
+      % replace the pivots <= tol * H_jj by tol * H_jj (static pivoting)
+      % the number of replaced pivots of each lane is stored in perturbedPivots
+      % an inaccurate lane with replaced pivots refines against A W A' in approxSolve, with its factor as the
+      % preconditioner, and is refactored in doubledouble (without replaced pivots) only if the refinement stalls
+      % logdet and leverageScoreComplement correct such a lane by a low rank term per replaced pivot, while
+      % diagL needs the factor of A W A' itself and refactors it in doubledouble
+      function setPivotTolerance(o, tol)
+         o.pivotTolerance = tol;
+         o.solver('setPivotTolerance', o.uid, tol);
+         if ~any(isnan(o.w))
+            w = o.w; o.w = NaN;
+            o.setScale(w);
+         end
+      end
+      
+      % replace the values of A by the ones of A2, which has the same pattern as A
+      % the orderings and the symbolic analysis are kept
+      function updateA(o, A2)
+         o.A = A2;
+         o.solver('updateA', o.uid, A2);
+         if ~any(isnan(o.w))
+            w = o.w; o.w = NaN;
+            o.setScale(w);
+         end
+      end
+      
+      % keep the values of the factors in memory mapped files in dir, so that they can exceed the RAM
+      function setScratchDirectory(o, dir)
+         o.scratchDir = dir;
+         o.solver('setScratchDirectory', o.uid, char(dir));
+         if ~any(isnan(o.w))
+            w = o.w; o.w = NaN;
+            o.setScale(w);
+         end
+      end
+      
       function counts = getDecomposeCount(o)
          counts = o.solver('getDecomposeCount', o.uid);
       end
@@ -125,6 +283,30 @@ classdef MexSolver < handle
          y2 = o.solver('solve', o.uid, b);
       end
       
+      % approxSolve for the r columns of B with one pass over the factor for every few columns
+      % B is m x r, or k x m x r with k lanes, and y has the size of B
+      function y = approxSolveMany(o, B)
+         assert(o.initialized);
+         
+         if o.k == 0
+            y = o.solver('solveMany', o.uid, B);
+         else
+            y = reshape(o.solver('solveMany', o.uid, reshape(B, o.k, [])), size(B));
+         end
+      end
+      
+      % approxSolve for the columns of the sparse m x r B, the same right hand sides in all lanes
+      % only the part of the factor reachable from the nonzeros of B is used in the forward solve
+      % y is m x r, or k x m x r with k lanes
+      function y = approxSolveSparse(o, B)
+         assert(o.initialized);
+         
+         y = o.solver('solveSparse', o.uid, sparse(B));
+         if o.k ~= 0
+            y = reshape(y, o.k, size(B, 1), []);
+         end
+      end
+      
       function x = solve(o, b, w, x0)
          assert(o.initialized);
          
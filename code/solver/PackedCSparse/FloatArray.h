@@ -1,5 +1,7 @@
 #pragma once
 #include <immintrin.h>
+#include <algorithm>
+#include <cfloat>
 #include <random>
 #include <type_traits>
 
@@ -17,6 +19,13 @@ namespace PackedCSparse {
 				x[i] = rhs;
 		}
 
+		template<size_t k2>
+		BaseImpl(const BaseImpl<T, k2>& rhs)
+		{
+			for (size_t i = 0; i < k; i++)
+				x[i] = rhs.x[i % k2];
+		}
+
 		BaseImpl operator+(const BaseImpl& rhs) const
 		{
 			BaseImpl lhs;
@@ -149,6 +158,25 @@ namespace PackedCSparse {
 			return out;
 		}
 
+		// sqrt(a) with static pivoting: if a <= tol * h, use sqrt(tol * h) instead (or nonpos_output
+		// if tol * h <= 0) and increase count by 1
+		static BaseImpl pivot_sqrt(const BaseImpl& a, const BaseImpl& h, const T tol, const T nonpos_output, BaseImpl& count)
+		{
+			BaseImpl out;
+			for (size_t i = 0; i < k; i++)
+			{
+				T r = a.x[i], t = tol * h.x[i];
+				if (r > t)
+					out.x[i] = sqrt(r);
+				else
+				{
+					out.x[i] = (t > 0) ? sqrt(t) : nonpos_output;
+					count.x[i] += T(1);
+				}
+			}
+			return out;
+		}
+
 		static BaseImpl sign(std::mt19937_64& gen)
 		{
 			BaseImpl out;
@@ -204,6 +232,19 @@ namespace PackedCSparse {
 				return nonpos_output;
 		}
 
+		static T pivot_sqrt(const T& x, const T& h, const T& tol, const T& nonpos_output, T& count)
+		{
+			T t = tol * h;
+			if (x > t)
+				return sqrt(x);
+
+			count += T(1.0);
+			if (t > 0)
+				return sqrt(t);
+			else
+				return nonpos_output;
+		}
+
 		static T sign(std::mt19937_64& gen)
 		{
 			unsigned long long seed = gen();
@@ -211,6 +252,17 @@ namespace PackedCSparse {
 		}
 	};
     
+	// Flush denormals to zero while in scope. The single precision factor has many entries
+	// below the normal range of float and denormal arithmetic is much slower.
+	struct FlushDenormals
+	{
+#ifdef __SSE__
+		unsigned int csr;
+		FlushDenormals() : csr(_mm_getcsr()) { _mm_setcsr(csr | 0x8040); } // FTZ and DAZ
+		~FlushDenormals() { _mm_setcsr(csr); }
+#endif
+	};
+
 	template <typename T, size_t k>
 	struct FloatTypeSelector
 	{
@@ -279,6 +331,12 @@ namespace PackedCSparse {
 		return FloatArrayFunc<T1>::clipped_sqrt(a, b);
 	}
 
+	template<typename T1, typename T2>
+	T1 pivot_sqrt(const T1& a, const T1& h, const T2 tol, const T2 nonpos_output, T1& count)
+	{
+		return FloatArrayFunc<T1>::pivot_sqrt(a, h, tol, nonpos_output, count);
+	}
+
 	template<typename T>
 	T abs(const T& a)
 	{
@@ -175,6 +175,26 @@ template<size_t k>
         return out;
     }
     
+    static m256dArray pivot_sqrt(const m256dArray& x, const m256dArray& h, const double tol, const double nonpos_output, m256dArray& count)
+    {
+        m256dArray out;
+        
+        const __m256d large = _mm256_set1_pd(nonpos_output);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d tolx = _mm256_set1_pd(tol);
+        for (size_t i = 0; i < k; i++)
+        {
+            __m256d xi = x.x[i], ti = _mm256_mul_pd(tolx, h.x[i]);
+            __m256d mask = _mm256_cmp_pd(xi, ti, _CMP_LE_OS); // mask = (x <= tol * h) ? -1 : 0
+            __m256d yi = _mm256_blendv_pd(xi, ti, mask);
+            __m256d nonpos = _mm256_cmp_pd(yi, zero, _CMP_LE_OS);
+            out.x[i] = _mm256_blendv_pd(_mm256_sqrt_pd(yi), large, nonpos);
+            count.x[i] = _mm256_add_pd(count.x[i], _mm256_and_pd(mask, one));
+        }
+        return out;
+    }
+    
     static m256dArray sign(std::mt19937_64& gen)
     {
         m256dArray out;
@@ -197,6 +217,227 @@ template<size_t k>
     }
 };
 
+// 4 floats per register. Used by the single precision factor of PackedChol, which moves
+// half the bytes of m256dArray for the same number of lanes.
+template<size_t k>
+        struct m128Array
+{
+    __m128 x[k];
+    
+    m128Array() {};
+    
+    m128Array(const float rhs)
+    {
+        for (size_t i = 0; i < k; i++)
+            x[i] = _mm_set1_ps(rhs);
+    }
+    
+    template<size_t k2>
+            m128Array(const m128Array<k2>& rhs)
+    {
+        for (size_t i = 0; i < k; i++)
+            x[i] = rhs.x[i % k2];
+    }
+    
+    m128Array operator+(const m128Array& rhs) const
+    {
+        m128Array out;
+        for (size_t i = 0; i < k; i++)
+            out.x[i] = _mm_add_ps(x[i], rhs.x[i]);
+        return out;
+    }
+    
+    m128Array operator-(const m128Array& rhs) const
+    {
+        m128Array out;
+        for (size_t i = 0; i < k; i++)
+            out.x[i] = _mm_sub_ps(x[i], rhs.x[i]);
+        return out;
+    }
+    
+    m128Array operator*(const m128Array& rhs) const
+    {
+        m128Array out;
+        for (size_t i = 0; i < k; i++)
+            out.x[i] = _mm_mul_ps(x[i], rhs.x[i]);
+        return out;
+    }
+    
+    m128Array operator/(const m128Array& rhs) const
+    {
+        m128Array out;
+        for (size_t i = 0; i < k; i++)
+            out.x[i] = _mm_div_ps(x[i], rhs.x[i]);
+        return out;
+    }
+    
+    m128Array& operator+=(const m128Array& rhs)
+    {
+        for (size_t i = 0; i < k; i++)
+            x[i] = _mm_add_ps(x[i], rhs.x[i]);
+        return *this;
+    }
+    
+    m128Array& operator-=(const m128Array& rhs)
+    {
+        for (size_t i = 0; i < k; i++)
+            x[i] = _mm_sub_ps(x[i], rhs.x[i]);
+        return *this;
+    }
+    
+    m128Array& operator*=(const m128Array& rhs)
+    {
+        for (size_t i = 0; i < k; i++)
+            x[i] = _mm_mul_ps(x[i], rhs.x[i]);
+        return *this;
+    }
+    
+    m128Array& operator/=(const m128Array& rhs)
+    {
+        for (size_t i = 0; i < k; i++)
+            x[i] = _mm_div_ps(x[i], rhs.x[i]);
+        return *this;
+    }
+    
+    explicit operator bool() const
+    {
+        bool ret = false;
+        __m128 z = _mm_setzero_ps();
+        for (size_t i = 0; i < k; i++)
+        {
+            __m128 c = _mm_cmp_ps(x[i], z, _CMP_EQ_OQ);
+            ret = ret || (_mm_movemask_ps(c) != 0xf);
+        }
+        return ret;
+    }
+    
+    static float get(const m128Array& x, size_t index)
+    {
+        alignas(16) float y[4];
+        _mm_store_ps(y, x.x[index / 4]);
+        return y[index & 3];
+    }
+    
+    static void set(m128Array& x, size_t index, float value)
+    {
+        __m128 v = _mm_set1_ps(value);
+        switch (index & 3)
+        {
+            case 0:  x.x[index / 4] = _mm_blend_ps(x.x[index / 4], v, 1); break;
+            case 1:  x.x[index / 4] = _mm_blend_ps(x.x[index / 4], v, 2); break;
+            case 2:  x.x[index / 4] = _mm_blend_ps(x.x[index / 4], v, 4); break;
+            default: x.x[index / 4] = _mm_blend_ps(x.x[index / 4], v, 8); break;
+        }
+    }
+    
+    static m128Array abs(const m128Array& x)
+    {
+        const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        
+        m128Array out;
+        for (size_t i = 0; i < k; i++)
+            out.x[i] = _mm_and_ps(x.x[i], mask);
+        return out;
+    }
+    
+    static m128Array log(const m128Array& x)
+    {
+        m128Array out;
+        for (size_t i = 0; i < 4*k; i++)
+            set(out, i, std::log(get(x,i)));
+        return out;
+    }
+    
+    static void fmadd(m128Array& a, const m128Array& b, const float& c)
+    {
+        auto cx = _mm_set1_ps(c);
+        for (size_t i = 0; i < k; i++)
+            a.x[i] = _mm_fmadd_ps(b.x[i], cx, a.x[i]);
+    }
+    
+    static void fnmadd(m128Array& a, const m128Array& b, const float& c)
+    {
+        auto cx = _mm_set1_ps(c);
+        for (size_t i = 0; i < k; i++)
+            a.x[i] = _mm_fnmadd_ps(b.x[i], cx, a.x[i]);
+    }
+    
+    static void fmadd(m128Array& a, const m128Array& b, const m128Array& c)
+    {
+        for (size_t i = 0; i < k; i++)
+            a.x[i] = _mm_fmadd_ps(b.x[i], c.x[i], a.x[i]);
+    }
+    
+    static void fnmadd(m128Array& a, const m128Array& b, const m128Array& c)
+    {
+        for (size_t i = 0; i < k; i++)
+            a.x[i] = _mm_fnmadd_ps(b.x[i], c.x[i], a.x[i]);
+    }
+    
+    static m128Array clipped_sqrt(const m128Array& x, const double nonpos_output)
+    {
+        m128Array out;
+        
+        // nonpos_output is clamped to the range of float
+        const __m128 large = _mm_set1_ps(float(std::min(nonpos_output, double(FLT_MAX))));
+        const __m128 zero = _mm_setzero_ps();
+        for (size_t i = 0; i < k; i++)
+        {
+            __m128 xi = x.x[i];
+            __m128 mask = _mm_cmp_ps(xi, zero, _CMP_LE_OS); // mask = (rhs.x[i]<= 0) ? -1 : 0
+            out.x[i] = _mm_blendv_ps(_mm_sqrt_ps(xi), large, mask);
+        }
+        return out;
+    }
+    
+    static m128Array pivot_sqrt(const m128Array& x, const m128Array& h, const double tol, const double nonpos_output, m128Array& count)
+    {
+        m128Array out;
+        
+        const __m128 large = _mm_set1_ps(float(std::min(nonpos_output, double(FLT_MAX))));
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 tolx = _mm_set1_ps(float(tol));
+        for (size_t i = 0; i < k; i++)
+        {
+            __m128 xi = x.x[i], ti = _mm_mul_ps(tolx, h.x[i]);
+            __m128 mask = _mm_cmp_ps(xi, ti, _CMP_LE_OS); // mask = (x <= tol * h) ? -1 : 0
+            __m128 yi = _mm_blendv_ps(xi, ti, mask);
+            __m128 nonpos = _mm_cmp_ps(yi, zero, _CMP_LE_OS);
+            out.x[i] = _mm_blendv_ps(_mm_sqrt_ps(yi), large, nonpos);
+            count.x[i] = _mm_add_ps(count.x[i], _mm_and_ps(mask, one));
+        }
+        return out;
+    }
+    
+    static m128Array sign(std::mt19937_64& gen)
+    {
+        m128Array out;
+        unsigned long long seed = gen();
+        for (size_t i = 0; i < 4*k; i++)
+        {
+            set(out, i, float((2 * ((seed >> (i & 63)) & 1)) - 1.0));
+            if ((i & 63) == 63) seed = gen();
+        }
+        return out;
+    }
+};
+
+template <size_t k>
+        struct FloatTypeSelector<float, k>
+{
+    static_assert(k == 1 || k % 4 == 0, "Array<float,k> assumes k = 1 or a multiple of 4");
+    using type = typename std::conditional< k == 1, float, m128Array<k / 4>>::type;
+    using funcImpl = typename std::conditional< k == 1, BaseScalarImpl<float>, m128Array<k / 4>>::type;
+};
+
+template <size_t k, size_t l>
+        struct FloatTypeSelector<m128Array<k>, l>
+{
+    using type = m128Array<k* l>;
+    using funcImpl = m128Array<k* l>;
+};
+
 template <size_t k>
         struct FloatTypeSelector<double, k>
 {
@@ -1,11 +1,16 @@
 #pragma once
+#include <cstdio>
+#include <limits>
 #include <random>
 #include <vector>
 #include "SparseMatrix.h"
 #include "chol.h"
+#include "cholupdate.h"
 #include "multiply.h"
 #include "leverage.h"
 #include "leverageJL.h"
+#include "ordering.h"
+#include "serialize.h"
 #include "../qd/dd_real.h"
 
 using namespace PackedCSparse;
@@ -24,25 +29,129 @@ void set_slice(Tout* out, Tin* in, size_t n, size_t idx)
 		set(out[j], idx, double(in[j]));
 }
 
+// The predicted cost of a solver (see PackedChol::analyze)
+struct PackedCholAnalysis : CholAnalysis
+{
+	double bytesPerLane = 0.0;	// values of H, L and inv(L L')|_L and the vectors, in double
+	double bytesIndex = 0.0;	// patterns of H, L, L' and A, A', shared by the lanes
+};
+
+// The part of PackedChol that depends only on the pattern of the input A and the ordering.
+// It is read only once built and shared by all solvers with the same pattern
+// (the mex module keeps a cache of them keyed by a hash of the pattern).
+template <typename Ti>
+struct PackedCholSymbolic
+{
+	Ordering ordering = Ordering::Natural;
+	bool postorder = false;
+	SparseMatrix<bool, Ti> input;		// the pattern of the input A
+	SharedPtr<Ti> perm;					// see PackedChol::perm
+	SparseMatrix<bool, Ti> A, At;		// the patterns of the permuted A and of A'
+	SharedPtr<Ti> Amap;					// the entry s of the input A is the entry Amap[s] of A (null for the natural ordering)
+	SharedPtr<Ti> Atmap;				// the entry s of A is the entry Atmap[s] of At (see TransposeOutput::forward)
+	CholOutput<bool, Ti> L[4];			// the symbolic analysis of chol for each CholMethod except Auto (built on first use)
+	CholMethod tuned = CholMethod::Auto;	// the kernel selected by chol_autotune in any of the solvers
+
+	// true if B has the pattern of the input A
+	template <typename Tx>
+	bool matches(const SparseMatrix<Tx, Ti>& B, Ordering ordering_, bool postorder_) const
+	{
+		if (B.m != input.m || B.n != input.n || ordering_ != ordering || postorder_ != postorder)
+			return false;
+		return std::equal(B.p.get(), B.p.get() + B.n + 1, input.p.get())
+			&& std::equal(B.i.get(), B.i.get() + B.nnz(), input.i.get());
+	}
+
+	// Write the analysis to path such that load maps it back (see serialize.h).
+	// The file is replaced at the end so that processes mapping the old file are not affected.
+	void save(const char* path)
+	{
+		std::string tmp = std::string(path) + ".tmp";
+		{
+			FileWriter ar(tmp.c_str(), magic(), sizeof(Ti));
+			serialize(ar);
+		}
+#ifdef _WIN32
+		std::remove(path);
+#endif
+		pcs_assert(std::rename(tmp.c_str(), path) == 0, "PackedCholSymbolic: cannot replace the file.");
+	}
+
+	// Memory map a file written by save. The arrays point into the mapping.
+	static std::shared_ptr<PackedCholSymbolic> load(const char* path)
+	{
+		auto S = std::make_shared<PackedCholSymbolic>();
+		FileReader ar(path, magic(), sizeof(Ti));
+		S->serialize(ar);
+		return S;
+	}
+
+	template <typename Archive>
+	void serialize(Archive& ar)
+	{
+		ar.scalar(ordering); ar.scalar(postorder); ar.scalar(tuned);
+		for (SparseMatrix<bool, Ti>* M : { &input, &A, &At })
+		{
+			ar.scalar(M->m); ar.scalar(M->n);
+			ar.array(M->p, size_t(M->n) + 1);
+			ar.array(M->i, M->p ? size_t(M->nnz()) : 0);
+		}
+
+		size_t nz = input.p ? size_t(input.nnz()) : 0;
+		ar.array(perm, size_t(input.m));
+		ar.array(Amap, nz);
+		ar.array(Atmap, nz);
+		for (CholOutput<bool, Ti>& Lm : L)
+			Lm.serialize(ar);
+	}
+
+	// the tag at the start of the file, zero padded to 8 bytes
+	static const char (&magic())[8]
+	{
+		static const char tag[8] = "PCSYM2";
+		return tag;
+	}
+};
+
 template <int k, typename Ti>
 struct PackedChol
 {
 	using Tx = double;
 	using Tx2 = FloatArray<double, k>;
+	using Tf2 = FloatArray<float, k>;
 	using Te = dd_real;
 
 	// parameters
-	SparseMatrix<Tx, Ti> A;
-	SparseMatrix<Tx, Ti> At;
+	SparseMatrix<Tx, Ti> A;		// the rows of A are permuted by perm
+	TransposeOutput<Tx, Ti> At;
+	SharedPtr<Ti> Amap;			// the entry s of the input A is the entry Amap[s] of A (null until needed or for the natural ordering)
 	UniqueAlignedPtr<Tx2> w;
+	SharedPtr<Ti> perm;				// row i of A is row perm[i] of the input (null for the natural ordering)
+	UniqueAlignedPtr<Tx2> b_perm;	// workspace for permuting the right hand side
 	Tx accuracyThreshold = 1e-6;
+	Ti maxUpdateRank = 32;		// update refactorizes if more weights changed
+	static constexpr size_t solveBlock = 4;	// solveMany solves this many columns with one pass over L
+	Tx pivotTolerance = 0.0;	// static pivoting: a pivot d <= pivotTolerance * H_jj is replaced (see CholOutput::pivot_tol)
+	Tx perturbedPivots[k] = {};	// the number of replaced pivots of each lane of L (or Lf) in the last decompose
+	Tx refineLimit = 0.5;		// an inaccurate lane with replaced pivots and an accuracy below this refines in solve instead of using dd_real
 	std::vector<size_t> exactIdx; // k size array. Indices we perform high precision calculation
+	std::vector<size_t> refinedIdx; // lanes solved with L as a preconditioner of H, factored in dd_real only if needed (see refine_perturbed, perturbed_correction)
+	size_t maxCorrectionRank = 32;	// a refined lane with more replaced pivots uses dd_real for logdet and the leverage scores
+	bool correctionReady = false;	// correctionZ and correctionLogdet belong to the current L (see perturbed_correction)
+	size_t correctionRank = 0;
+	UniqueAlignedPtr<Tx2> correctionZ;	// m x correctionRank, inv(H) = inv(L L') + Z Z' on the refined lanes
+	Tx correctionLogdet[k] = {};		// logdet(H) - logdet(L L') of the refined lanes, halved like the sums of log(L_jj)
 	std::vector<size_t> numExact; // number of times we perform high precision decompose (length k+1, the last one records how many times we do decompose)
+	bool fusedAssembly = true;		// chol builds the columns of H from A and w instead of reading the stored H
+	std::string scratchDir;			// out of core: if not empty, the values of the factors are in scratch files in this directory (see setScratchDirectory)
 	bool decomposed = false;
+	bool doubleFactored = false;	// L and Le are the factors of the current w (see mixedPrecision)
+	std::shared_ptr<PackedCholSymbolic<Ti>> symbolic; // shared with the other solvers of the same pattern (null if not shared)
 	
 	// preprocess info for different CSparse operations (PackedDouble)
-	MultiplyOutput<Tx2, Ti> H; // cache for H = A W A'
+	MultiplyOutput<Tx2, Ti> H; // cache for H = A W A' (only its lower triangle, see MultiplyOutput::lower), unused with fusedAssembly
 	CholOutput<Tx2, Ti> L; // cache for L = chol(H)
+	std::unique_ptr<CholAutotune<Tx2, Ti>> Ltune; // selects the kernel of L during the first calls (null unless CholMethod::Auto is set, and once it is fixed)
 	LeverageOutput<Tx2, Ti> diagP; // cache for L = chol(H)
 	LeverageJLOutput<Tx2, Ti> diagPJL; // cache for L = chol(H)
 
@@ -53,12 +162,350 @@ struct PackedChol
 	LeverageJLOutput<Te, Ti> diagPJL_exact; // cache for L = chol(H)
 	SparseMatrix<Te, Ti> Le[k]; // store output of L_exact
 
-	PackedChol(const SparseMatrix<Tx, Ti>& A_)
+	// mixed precision: decompose factors H in float, solve refines in double and
+	// L is computed only when a lane stalls or another operation needs it.
+	// It only pays off when the solves dominate: logdet, diagL, getL and the leverage scores
+	// call ensureDouble, so a step that needs them factors H both in float and in double.
+	bool mixedPrecision = false;
+	size_t maxRefineSteps = 10;
+	Tx refineTolerance = 1e-14;		// target of |b - H x| / (|H| |x| + |b|) in the infinity norm
+	MultiplyOutput<Tf2, Ti> Hf;		// H in float, with the pattern of H
+	CholOutput<Tf2, Ti> Lf;			// cache for Lf = chol(Hf)
+	Tx Hnorm[k];					// |H| in the infinity norm of each lane (not a Tx2, which would over-align PackedChol)
+	UniqueAlignedPtr<Tx2> refine_x, refine_r;
+	UniqueAlignedPtr<Tf2> refine_d;
+
+	// lane groups: the threads of setThreads factorize groups of laneGroupWidth lanes instead of subtrees.
+	// The lanes are independent, so each group runs the whole symbolic schedule of L on its own slice of w
+	// and the values are copied into the lanes of L. Lg keeps a second copy of the values of L.
+	// It needs at least two groups of 4 lanes (k = 8, 12, ...), the 1 and 4 lane solvers cannot use it.
+	static constexpr size_t laneGroupWidth = (k > 4 && k % 4 == 0) ? 4 : k;
+	static constexpr size_t laneGroupCount = k / laneGroupWidth;
+	using Tg2 = FloatArray<double, laneGroupWidth>;
+	bool laneGroups = false;
+	CholOutput<Tg2, Ti> Lg[laneGroupCount];		// the factor of each group, sharing the pattern of L
+	UniqueAlignedPtr<Tg2> wg[laneGroupCount];	// the lanes of w of each group
+
+	// postorder relabels the rows after the ordering (see relabel)
+	PackedChol(const SparseMatrix<Tx, Ti>& A_, Ordering ordering = Ordering::Natural, bool postorder = false)
 	{
 		A = std::move(A_.clone());
 		At = transpose(A);
 		w.reset(pcs_aligned_new<Tx2>(A.n));
 		numExact.resize(k + 1);
+		H.lower = H_exact.lower = true;
+
+		if (ordering != Ordering::Natural)
+			reorder(ordering);
+		if (postorder)
+			relabel();
+		groupComponents();
+	}
+
+	// A solver for A_ that uses the symbolic analysis of other solvers with the same pattern.
+	// Only the numeric arrays are allocated.
+	PackedChol(const SparseMatrix<Tx, Ti>& A_, std::shared_ptr<PackedCholSymbolic<Ti>> symbolic_)
+		: symbolic(std::move(symbolic_))
+	{
+		const PackedCholSymbolic<Ti>& S = *symbolic;
+		pcs_assert(S.matches(A_, S.ordering, S.postorder), "PackedChol: the pattern of A does not match.");
+
+		Ti m = A_.m, n = A_.n, nz = A_.nnz();
+		A.m = m; A.n = n; A.p = S.A.p; A.i = S.A.i;
+		At.m = n; At.n = m; At.p = S.At.p; At.i = S.At.i; At.forward = S.Atmap;
+		A.x.reset(pcs_aligned_new<Tx>(nz > 0 ? nz : 1));
+		At.x.reset(pcs_aligned_new<Tx>(nz > 0 ? nz : 1));
+		for (Ti s = 0; s < nz; s++)
+			A.x[S.Amap ? S.Amap[s] : s] = A_.x[s];
+		transpose(At, A);
+
+		perm = S.perm;
+		Amap = S.Amap;
+		if (perm)
+			b_perm.reset(pcs_aligned_new<Tx2>(m));
+		w.reset(pcs_aligned_new<Tx2>(n));
+		numExact.resize(k + 1);
+		H.lower = H_exact.lower = true;
+	}
+
+	// Predict the cost of the solver from the column counts of L without factorizing (see chol_analyze).
+	// The counts are the ones stored by the kernel of L, the first candidate if it is still autotuned.
+	PackedCholAnalysis analyze() const
+	{
+		MultiplyOutput<bool, Ti> AAt; // pattern only
+		AAt.initialize(A, At);
+
+		PackedCholAnalysis r;
+		static_cast<CholAnalysis&>(r) = chol_analyze(AAt, L);
+		double m = double(A.m), n = double(A.n);
+		r.bytesPerLane = sizeof(double) * (r.nnzH + 2.0 * r.nnzL + 4.0 * m + n);
+		r.bytesIndex = sizeof(Ti) * (r.nnzH + 2.0 * r.nnzL + 2.0 * double(A.nnz()) + 4.0 * m);
+		return r;
+	}
+
+	// Build the symbolic part of this solver to share it with other solvers of the same pattern.
+	// A_, ordering and postorder are the arguments this solver was constructed with.
+	std::shared_ptr<PackedCholSymbolic<Ti>> makeSymbolic(const SparseMatrix<Tx, Ti>& A_, Ordering ordering, bool postorder)
+	{
+		auto S = std::make_shared<PackedCholSymbolic<Ti>>();
+		Ti m = A.m, n = A.n;
+		S->ordering = ordering;
+		S->postorder = postorder;
+		S->input.m = m; S->input.n = n; S->input.p = A_.p; S->input.i = A_.i;
+		S->perm = perm;
+		S->A.m = m; S->A.n = n; S->A.p = A.p; S->A.i = A.i;
+		S->At.m = n; S->At.n = m; S->At.p = At.p; S->At.i = At.i;
+
+		buildInputMap(A_);
+		S->Amap = Amap;
+		S->Atmap = At.forward;
+
+		symbolic = S;
+		return S;
+	}
+
+	// Compute Amap from the input A_ (a matrix with the pattern this solver was constructed with)
+	void buildInputMap(const SparseMatrix<Tx, Ti>& A_)
+	{
+		if (!perm || Amap) return;
+
+		// the rows of each column of A are sorted
+		Ti m = A.m, n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+		Ti* pinv = new Ti[m];
+		for (Ti i = 0; i < m; i++)
+			pinv[perm[i]] = i;
+		Amap.reset(new Ti[A.nnz()]);
+		for (Ti j = 0; j < n; j++)
+			for (Ti s = A_.p[j]; s < A_.p[j + 1]; s++)
+				Amap[s] = Ti(std::lower_bound(Ai + Ap[j], Ai + Ap[j + 1], pinv[A_.i[s]]) - Ai);
+		delete[] pinv;
+	}
+
+	// Replace the values of A by the ones of A_, which must have the pattern this solver was constructed with.
+	// The ordering, the symbolic analysis and the workspaces are kept, A' is refreshed through its forward map
+	// and the next decompose refactorizes.
+	void updateA(const SparseMatrix<Tx, Ti>& A_)
+	{
+		pcs_assert(A_.initialized() && A_.m == A.m && A_.n == A.n && A_.nnz() == A.nnz(), "updateA: the pattern of A does not match.");
+		buildInputMap(A_);
+
+		Ti n = A.n, nz = A.nnz(), * Ap = A.p.get(), * Ai = A.i.get();
+		bool match = true;
+		for (Ti j = 0; j < n; j++)
+			match = match && A_.p[j + 1] == Ap[j + 1];
+		for (Ti s = 0; s < nz && match; s++)
+		{
+			Ti q = Amap ? Amap[s] : s;
+			match = (perm ? perm[Ai[q]] : Ai[q]) == A_.i[s];
+		}
+		pcs_assert(match, "updateA: the pattern of A does not match.");
+
+		for (Ti s = 0; s < nz; s++)
+			A.x[Amap ? Amap[s] : s] = A_.x[s];
+		transpose(At, A);
+		decomposed = false;
+	}
+
+	// The shared symbolic analysis of chol for method, computed if no solver did.
+	const CholOutput<bool, Ti>& buildSymbolic(CholMethod method, double dense_ratio, Ti dense_min)
+	{
+		CholOutput<bool, Ti>& S = symbolic->L[int(method)];
+		if (!S.initialized())
+		{
+			S.method = method;
+			S.dense_ratio = dense_ratio;
+			S.dense_min = dense_min;
+			MultiplyOutput<bool, Ti> AAt; // pattern only
+			AAt.initialize(A, At);
+			S.initialize(AAt);
+		}
+		return S;
+	}
+
+	// Use the symbolic analysis of o from symbolic, after computing it there if no solver did.
+	// o keeps its own analysis if its parameters differ from the shared one.
+	template <typename T>
+	void shareSymbolic(CholOutput<T, Ti>& o)
+	{
+		if (!symbolic || o.initialized() || o.method == CholMethod::Auto)
+			return;
+
+		const CholOutput<bool, Ti>& S = buildSymbolic(o.method, o.dense_ratio, o.dense_min);
+		if (S.dense_ratio == o.dense_ratio && S.dense_min == o.dense_min)
+			o.share(S);
+	}
+
+	// Permute the rows of A to reduce the fill of chol(A W A')
+	void reorder(Ordering ordering)
+	{
+		MultiplyOutput<bool, Ti> AAt;
+		AAt.initialize(A, At);
+		UniquePtr<Ti> p;
+		if (ordering == Ordering::AMD)
+			p = amd(AAt);
+		else if (ordering == Ordering::NestedDissection)
+			p = nested_dissection(AAt);
+		else
+			pcs_assert(false, "reorder: unknown ordering.");
+
+		permute(p.get());
+	}
+
+	// Permute the rows of A by a postorder of the elimination tree of A A'. The pattern of L is the same
+	// up to the relabeling, but the columns of every subtree are next to each other in memory.
+	void relabel()
+	{
+		MultiplyOutput<bool, Ti> AAt;
+		AAt.initialize(A, At);
+		UniquePtr<Ti> parent = etree(AAt);
+		UniquePtr<Ti> post = postorder(parent.get(), A.m);
+		permute(post.get());
+	}
+
+	// Permute the rows of A such that the rows of each connected component of the graph of A A' are next
+	// to each other, keeping their order. The fill of L does not change and L is block diagonal with
+	// one block for each component, which chol, solve and leverage run in parallel (see CholOutput::nblocks).
+	void groupComponents()
+	{
+		Ti m = A.m, n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+
+		// union-find on the rows, the root of a component is its first row
+		std::vector<Ti> root(m);
+		for (Ti i = 0; i < m; i++)
+			root[i] = i;
+		auto find = [&root](Ti i) {
+			while (root[i] != i)
+			{
+				root[i] = root[root[i]];
+				i = root[i];
+			}
+			return i;
+		};
+		for (Ti j = 0; j < n; j++)
+		{
+			for (Ti s = Ap[j] + 1; s < Ap[j + 1]; s++)
+			{
+				Ti a = find(Ai[Ap[j]]), b = find(Ai[s]);
+				if (a != b) root[std::max(a, b)] = std::min(a, b);
+			}
+		}
+
+		// the components are contiguous iff every row is the first row of its component or follows a row of it
+		bool grouped = true;
+		std::vector<Ti> start(size_t(m) + 1, 0);
+		for (Ti i = 0; i < m; i++)
+		{
+			Ti r = find(i);
+			if (r != i && r != find(i - 1)) grouped = false;
+			start[r + 1]++;
+		}
+		if (grouped) return;
+
+		for (Ti i = 0; i < m; i++)
+			start[i + 1] += start[i];
+		UniquePtr<Ti> p(new Ti[m]);
+		for (Ti i = 0; i < m; i++)
+			p[start[find(i)]++] = i;
+		permute(p.get());
+	}
+
+	// Permute the rows of A such that the new row i is the current row p[i] (on top of the current perm)
+	void permute(const Ti* p)
+	{
+		Ti m = A.m;
+		UniquePtr<Ti> perm_new(new Ti[m]);
+		for (Ti i = 0; i < m; i++)
+			perm_new[i] = perm ? perm[p[i]] : p[i];
+		perm = std::move(perm_new);
+		Amap.reset();
+
+		Ti* pinv = new Ti[m];
+		for (Ti i = 0; i < m; i++)
+			pinv[p[i]] = i;
+		A = permute_rows(A, pinv);
+		At = transpose(A);
+		b_perm.reset(pcs_aligned_new<Tx2>(m));
+		delete[] pinv;
+	}
+
+	// Factorize independent subtrees of the elimination tree and solve the diagonal blocks of L with nthreads threads
+	void setThreads(size_t nthreads)
+	{
+		std::shared_ptr<ThreadPool> pool;
+		if (nthreads > 1)
+			pool = std::make_shared<ThreadPool>(nthreads);
+		L.pool = pool;
+		L_exact.pool = pool;
+		Lf.pool = pool;
+	}
+
+	// Split the lanes into groups factorized in parallel by the threads of setThreads (see laneGroups)
+	void setLaneGroups(bool on)
+	{
+		pcs_assert(!on || laneGroupCount > 1, "setLaneGroups: needs at least 8 lanes (a multiple of 4).");
+		laneGroups = on;
+		for (size_t g = 0; g < laneGroupCount; g++)
+			Lg[g] = CholOutput<Tg2, Ti>();
+	}
+
+	// Factorize in float and refine the solution in double (see mixedPrecision)
+	void setMixedPrecision(bool mixed)
+	{
+		mixedPrecision = mixed;
+		if (mixed && !refine_x)
+		{
+			Ti m = A.m;
+			refine_x.reset(pcs_aligned_new<Tx2>(m));
+			refine_r.reset(pcs_aligned_new<Tx2>(m));
+			refine_d.reset(pcs_aligned_new<Tf2>(m));
+		}
+		decomposed = false;
+	}
+
+	// Assemble the columns of H inside chol (the default) or store the lower triangle of H and factor it (see fusedAssembly)
+	void setFusedAssembly(bool fused)
+	{
+		fusedAssembly = fused;
+		decomposed = false;
+	}
+
+	// Select the numeric kernel of chol. This drops the symbolic analysis since the pattern of L depends on the kernel.
+	// CholMethod::Auto times all kernels for L during the next decompose calls and keeps the fastest.
+	// With a scratch directory Auto is the supernodal kernel, since timing keeps a second factor alive.
+	void setCholMethod(CholMethod method)
+	{
+		std::shared_ptr<ThreadPool> pool = L.pool;
+		bool tune = (method == CholMethod::Auto) && scratchDir.empty();
+		if (method == CholMethod::Auto && !tune)
+			method = CholMethod::Supernodal;
+		L = CholOutput<Tx2, Ti>();
+		L_exact = CholOutput<Te, Ti>();
+		L.method = method;
+		L_exact.method = (method == CholMethod::Auto) ? CholMethod::Supernodal : method;
+		L.pool = L_exact.pool = pool;
+		L.scratch_dir = L_exact.scratch_dir = scratchDir;
+		Ltune.reset(tune ? new CholAutotune<Tx2, Ti>() : nullptr);
+		Lf = CholOutput<Tf2, Ti>();
+		Lf.method = L_exact.method;
+		Lf.pool = pool;
+		Lf.scratch_dir = scratchDir;
+
+		diagP = LeverageOutput<Tx2, Ti>();
+		diagP_exact = LeverageOutput<Te, Ti>();
+		for (size_t i = 0; i < k; i++)
+			Le[i] = SparseMatrix<Te, Ti>();
+		for (size_t g = 0; g < laneGroupCount; g++)
+			Lg[g] = CholOutput<Tg2, Ti>();
+		decomposed = false;
+	}
+
+	// Keep the values of L, Le and inv(L L')|_L (for the leverage scores) in memory mapped scratch files
+	// in dir instead of RAM, so that problems larger than the memory page to disk (empty dir = in RAM).
+	// The symbolic analysis and the vectors stay in RAM. This drops the factors.
+	void setScratchDirectory(const std::string& dir)
+	{
+		scratchDir = dir;
+		setCholMethod(Ltune ? CholMethod::Auto : L.method);
 	}
 
 	void setSeed(unsigned long long seed)
@@ -80,8 +527,10 @@ struct PackedChol
 	template <typename Tv2_>
 	Tx2 decompose(const Tv2_* w_in)
 	{
-        Tx2 acc = Tx2(0.0);
-        
+		// another solver of the same pattern already selected the kernel
+		if (Ltune && symbolic && symbolic->tuned != CholMethod::Auto)
+			setCholMethod(symbolic->tuned);
+
 		// record w
 		Ti n = A.n;
 		for (Ti j = 0; j < n; j++)
@@ -91,55 +540,305 @@ struct PackedChol
 		++numExact[k];
 		if (accuracyThreshold > 0.0 || !decomposed) // the first time we call, always run the double chol.
 		{
-			multiply(H, A, w.get(), At);
-			chol(L, H);
 			decomposed = true;
-			
-			exactIdx.clear();
-			acc = estimateAccuracy();
-			for (size_t i = 0; i < k; i++)
+			doubleFactored = false;
+
+			if (mixedPrecision && accuracyThreshold > 0.0)
 			{
-				if (get(acc, i) >= accuracyThreshold) // >= is important for the case accuracyThreshold = 0.0, we need to compute everything exactly
-					exactIdx.push_back(i);
+				multiply(H, A, w.get(), At);
+				decompose_float();
+				exactIdx.clear();
+				refinedIdx.clear();
+				return Tx2(0.0); // the accuracy is controlled by the refinement in solve
 			}
+			if (!fusedAssembly && !laneParallel(L))
+				multiply(H, A, w.get(), At);
+			return decompose_double();
 		}
 		else if (!allExact())
 		{
 			exactIdx.clear();
+			refinedIdx.clear();
 			for (size_t i = 0; i < k; i++)
 				exactIdx.push_back(i);
 		}
 
-		if (hasExact())
+		decompose_exact(exactIdx);
+		return Tx2(0.0);
+	}
+
+	// L = chol(H), then redo the inaccurate lanes in dd_real
+	Tx2 decompose_double()
+	{
+		auto factor = [&](CholOutput<Tx2, Ti>& o)
 		{
-			Te* w_exact = new Te[n];
+			shareSymbolic(o);
+			if (laneParallel(o))
+				chol_lane_groups(o);
+			else if (fusedAssembly)
+				chol(o, A, w.get(), At);
+			else
+				chol(o, H);
+		};
 
-			for (size_t i : exactIdx)
+		L.pivot_tol = pivotTolerance;
+		if (Ltune)
+		{
+			bool changed = chol_autotune_general(*Ltune, L, factor);
+			if (changed)
+				diagP = LeverageOutput<Tx2, Ti>(); // the pattern of L changed
+			if (!Ltune->tuning())
+			{
+				if (symbolic)
+					symbolic->tuned = Ltune->method();
+				Ltune.reset();
+			}
+		}
+		else
+			factor(L);
+		doubleFactored = true;
+		for (size_t l = 0; l < k; l++)
+			perturbedPivots[l] = get(L.npert[0], l);
+
+		exactIdx.clear();
+		refinedIdx.clear();
+		correctionReady = false;
+		Tx2 acc = estimateAccuracy();
+		for (size_t i = 0; i < k; i++)
+		{
+			Tx acc_i = get(acc, i);
+			if (acc_i < accuracyThreshold) // < is important for the case accuracyThreshold = 0.0, we need to compute everything exactly (and a NaN from an overflow in L)
+				continue;
+
+			// acc_i measures L against H, so refinement with L as a preconditioner converges if acc_i < 1.
+			// Without static pivoting the replaced pivots are clipped to 1e128 and the lane needs dd_real.
+			if (accuracyThreshold > 0.0 && pivotTolerance > 0.0 && perturbedPivots[i] > 0.0 && acc_i < refineLimit)
+				refinedIdx.push_back(i);
+			else
+				exactIdx.push_back(i);
+		}
+
+		decompose_exact(exactIdx);
+		return acc;
+	}
+
+	bool laneParallel(const CholOutput<Tx2, Ti>& o) const
+	{
+		return laneGroups && laneGroupCount > 1 && o.pool && o.pool->size() > 1;
+	}
+
+	// o = chol(A W A') with one task per lane group, each assembling H from A and its lanes of w
+	void chol_lane_groups(CholOutput<Tx2, Ti>& o)
+	{
+		if (!o.initialized())
+		{
+			MultiplyOutput<bool, Ti> AAt; // pattern only
+			AAt.initialize(A, At);
+			o.initialize(AAt);
+		}
+
+		Ti m = A.m, n = A.n, nz = o.nnz();
+		const size_t W = laneGroupWidth;
+		std::vector<ThreadPool::Task> tasks;
+		for (size_t g = 0; g < laneGroupCount; g++)
+		{
+			tasks.push_back([this, &o, g, m, n, nz, W](size_t) {
+				CholOutput<Tg2, Ti>& Lo = Lg[g];
+				if (Lo.p.get() != o.p.get() || Lo.method != o.method)
+				{	// o has a new symbolic analysis
+					Lo = CholOutput<Tg2, Ti>();
+					Lo.scratch_dir = scratchDir;
+					Lo.share(o);
+				}
+				if (!wg[g])
+					wg[g].reset(pcs_aligned_new<Tg2>(n));
+				Lo.pivot_tol = o.pivot_tol;
+
+				// the groups write disjoint lanes of o (whole vectors for W = 4)
+				Tg2* w_g = wg[g].get(); Tx2* w_ = w.get();
+				for (Ti j = 0; j < n; j++)
+					for (size_t l = 0; l < W; l++)
+						set(w_g[j], l, get(w_[j], g * W + l));
+				chol(Lo, A, w_g, At);
+
+				Tg2* Lgx = Lo.x.get(), * Eg = Lo.E.get(); Tx2* Lx = o.x.get(), * E = o.E.get();
+				for (Ti s = 0; s < nz; s++)
+					for (size_t l = 0; l < W; l++)
+						set(Lx[s], g * W + l, get(Lgx[s], l));
+				for (Ti j = 0; j < m; j++)
+					for (size_t l = 0; l < W; l++)
+						set(E[j], g * W + l, get(Eg[j], l));
+				for (size_t l = 0; l < W; l++)
+					set(o.npert[0], g * W + l, get(Lo.npert[0], l));
+			});
+		}
+		o.pool->run(tasks);
+	}
+
+	// Le[i] = chol(H) in dd_real for the lanes i in lanes.
+	// The pivots are not perturbed (only the non-positive ones are clipped) since dd_real is the accurate fallback.
+	void decompose_exact(const std::vector<size_t>& lanes)
+	{
+		if (lanes.empty()) return;
+
+		Ti n = A.n;
+		Te* w_exact = new Te[n];
+
+		L_exact.pivot_tol = 0.0;
+		for (size_t i : lanes)
+		{
+			++numExact[i];
+			get_slice(w_exact, w.get(), n, i);
+			shareSymbolic(L_exact);
+			if (fusedAssembly)
+				chol(L_exact, A, w_exact, At);
+			else
 			{
-				++numExact[i];
-				get_slice(w_exact, w.get(), n, i);
 				multiply(H_exact, A, w_exact, At);
 				chol(L_exact, H_exact);
+			}
 
-				// copy result to Le[i]
-				if (!Le[i].initialized())
-					Le[i] = std::move(L_exact.template clone<Te, Ti>());
-				else
-				{
-					Ti nz = L_exact.nnz();
-					for (Ti s = 0; s < nz; ++s)
-						Le[i].x[s] = (L_exact.x[s]);
-				}
+			// copy result to Le[i], which shares the pattern of L_exact
+			Ti nz = L_exact.nnz();
+			if (!Le[i].initialized())
+			{
+				Le[i].m = L_exact.m; Le[i].n = L_exact.n;
+				Le[i].p = L_exact.p; Le[i].i = L_exact.i;
+				Le[i].x.reset(pcs_values_new<Te>(nz > 0 ? nz : 1, scratchDir));
 			}
+			for (Ti s = 0; s < nz; ++s)
+				Le[i].x[s] = (L_exact.x[s]);
+		}
+
+		delete[] w_exact;
+	}
+
+	// Lf = chol(float(H))
+	void decompose_float()
+	{
+		Ti m = A.m, nz = H.nnz();
+		if (!Hf.initialized())
+		{
+			Hf.m = m; Hf.n = m; Hf.p = H.p; Hf.i = H.i;
+			Hf.x.reset(pcs_aligned_new<Tf2>(nz > 0 ? nz : 1));
+			Hf.lower = H.lower;
+			Hf.upper.m = m; Hf.upper.n = m; Hf.upper.p = H.upper.p; Hf.upper.i = H.upper.i;
+			Hf.upper_s = H.upper_s;
+		}
+
+		Tx2* Hx = H.x.get(); Tf2* Hfx = Hf.x.get();
+		for (Ti s = 0; s < nz; s++)
+			for (size_t l = 0; l < k; l++)
+				set(Hfx[s], l, float(get(Hx[s], l)));
 
-			delete[] w_exact;
+		// |H| is the largest absolute column sum as H is symmetric, the column j is H(j:m, j) and H(j, 0:j-1)
+		std::fill(Hnorm, Hnorm + k, 0.0);
+		Ti* Up = H.upper.p.get(), * Ui = H.upper.i.get(), * Us = H.upper_s.get();
+		for (Ti j = 0; j < m; j++)
+		{
+			Tx2 sum = Tx2(0.0);
+			for (Ti s = H.p[j]; s < H.p[j + 1]; s++)
+				sum += abs(Hx[s]);
+			for (Ti q = Up[j]; q < Up[j + 1] && Ui[q] < j; q++)
+				sum += abs(Hx[Us[q]]);
+			for (size_t l = 0; l < k; l++)
+				Hnorm[l] = std::max(Hnorm[l], get(sum, l));
 		}
-        return acc;
+
+		FlushDenormals ftz;
+		Lf.pivot_tol = pivotTolerance;
+		shareSymbolic(Lf);
+		chol(Lf, Hf);
+		for (size_t l = 0; l < k; l++)
+			perturbedPivots[l] = double(get(Lf.npert[0], l));
+	}
+
+	// compute L if the last decompose was in float
+	void ensureDouble()
+	{
+		if (!doubleFactored)
+			decompose_double();
+	}
+
+	// move the lanes of refinedIdx with fallback[i] (all if null) to exactIdx and factor them in dd_real
+	void ensureExact(const bool* fallback = nullptr)
+	{
+		std::vector<size_t> lanes, kept;
+		for (size_t i : refinedIdx)
+			(!fallback || fallback[i] ? lanes : kept).push_back(i);
+		if (lanes.empty()) return;
+
+		refinedIdx = kept;
+		exactIdx.insert(exactIdx.end(), lanes.begin(), lanes.end());
+		std::sort(exactIdx.begin(), exactIdx.end());
+		decompose_exact(lanes);
+	}
+
+	// Same as decompose(w_new) given that the last decompose (or update) was called with w_old.
+	// If at most maxUpdateRank weights changed, L is updated by one rank-one update/downdate per
+	// changed weight. It falls back to decompose if a downdate breaks down or the result is inaccurate,
+	// and if some lane uses dd_real or has replaced pivots, as the update only applies to L = chol(H).
+	template <typename Tv2_>
+	Tx2 update(const Tv2_* w_old, const Tv2_* w_new)
+	{
+		if (!decomposed || !doubleFactored || mixedPrecision || accuracyThreshold <= 0.0)
+			return decompose(w_new);
+		if (hasExact() || !refinedIdx.empty() || std::any_of(perturbedPivots, perturbedPivots + k, [](Tx c) { return c > 0.0; }))
+			return decompose(w_new);
+
+		Ti n = A.n, m = A.m;
+		std::vector<Ti> changed;
+		for (Ti j = 0; j < n; j++)
+		{
+			Tx2 wj_old = w_old[j], wj_new = w_new[j];
+			bool differ = false;
+			for (size_t i = 0; i < k; i++)
+			{
+				if (get(wj_old, i) != get(w[j], i)) // w_old is not the weight of L
+					return decompose(w_new);
+				differ |= (get(wj_new, i) != get(wj_old, i));
+			}
+
+			if (differ)
+			{
+				if (Ti(changed.size()) >= maxUpdateRank)
+					return decompose(w_new);
+				changed.push_back(j);
+			}
+		}
+
+		for (Ti j : changed)
+		{
+			Tx2 wj_old = w_old[j], wj_new = w_new[j];
+			w[j] = wj_new;
+			cholupdate(L, A, j, wj_new - wj_old);
+		}
+
+		Ti* Lp = L.p.get(); Tx2* Lx = L.x.get();
+		for (Ti i = 0; i < m; i++)
+		{
+			for (size_t l = 0; l < k; l++)
+				if (!(get(Lx[Lp[i]], l) > 0.0)) // some downdate breaks down
+					return decompose(w_new);
+		}
+
+		Tx2 acc = estimateAccuracy();
+		for (size_t i = 0; i < k; i++)
+		{
+			if (!(get(acc, i) < accuracyThreshold)) // or NaN
+				return decompose(w_new);
+		}
+		++numExact[k];
+		exactIdx.clear();
+		refinedIdx.clear();
+		return acc;
 	}
 
 	Tx2 logdet()
 	{
 		pcs_assert(decomposed, "logdet: Need to call decompose first.");
+		ensureDouble();
+		perturbed_correction();
 		
 		Ti m = A.m;
 		Tx2 ret = Tx2(0);
@@ -149,6 +848,8 @@ struct PackedChol
 			Ti* Lp = L.p.get(); Tx2* Lx = L.x.get();
 			for (Ti j = 0; j < m; j++)
 				ret += log(Lx[Lp[j]]);
+			for (size_t i : refinedIdx)
+				set(ret, i, get(ret, i) + correctionLogdet[i]);
 		}
 
 		if (hasExact())
@@ -168,17 +869,22 @@ struct PackedChol
 		return ret * Tx2(2.0);
 	}
 
+	// The factor of H itself, so the refined lanes move to dd_real (L is the factor of H + diag(E))
 	void diagL(Tx2* out)
 	{
 		pcs_assert(decomposed, "diagL: Need to call decompose first.");
+		ensureDouble();
+		ensureExact();
 		
 		Ti m = A.m;
 
+		Ti* P = perm.get();
+
 		if (!allExact())
 		{
 			Ti* Li = L.i.get(), * Lp = L.p.get(); Tx2* Lx = L.x.get();
 			for (Ti j = 0; j < m; j++)
-				out[j] = Lx[Lp[j]];
+				out[P ? P[j] : j] = Lx[Lp[j]];
 		}
 
 		if (hasExact())
@@ -188,7 +894,7 @@ struct PackedChol
 				Ti* Lp = Le[i].p.get(); Te* Lx = Le[i].x.get();
 
 				for (Ti j = 0; j < m; j++)
-					set(out[j], i, Tx(Lx[Lp[j]]));
+					set(out[P ? P[j] : j], i, Tx(Lx[Lp[j]]));
 			}
 		}
 	}
@@ -196,12 +902,22 @@ struct PackedChol
 	SparseMatrix<double, Ti> getL(Ti i)
 	{
 		pcs_assert(decomposed, "getL: Need to call decompose first.");
+		ensureDouble();
+		ensureExact();
 		
-		Ti m = L.m, n = L.n, nz = L.nnz();
+		bool isExact = false;
+		for (size_t i_ : exactIdx)
+		{
+			if (i_ == i)
+				isExact = true;
+		}
+
+		// the exact factor may have a different pattern, e.g. from another CholMethod
+		Ti m = L.m, n = L.n, nz = isExact ? Le[i].nnz() : L.nnz();
 		SparseMatrix<double, Ti> out(m, n, nz);
 
-		Ti* outp = out.p.get(), * Lp = L.p.get();
-		Ti* outi = out.i.get(), * Li = L.i.get();
+		Ti* outp = out.p.get(), * Lp = isExact ? Le[i].p.get() : L.p.get();
+		Ti* outi = out.i.get(), * Li = isExact ? Le[i].i.get() : L.i.get();
 
 		for (Ti s = 0; s <= n; s++)
 			outp[s] = Lp[s];
@@ -209,11 +925,21 @@ struct PackedChol
 		for (Ti s = 0; s < nz; s++)
 			outi[s] = Li[s];
 
-		bool isExact = false;
-		for (size_t i_ : exactIdx)
+		// with an ordering, output L(pinv, :) such that H = L L'
+		UniquePtr<Ti> src(new Ti[nz]);
+		for (Ti s = 0; s < nz; s++)
+			src[s] = s;
+
+		if (perm)
 		{
-			if (i_ == i)
-				isExact = true;
+			for (Ti s = 0; s < nz; s++)
+				outi[s] = perm[Li[s]];
+
+			for (Ti j = 0; j < n; j++)
+				std::sort(src.get() + Lp[j], src.get() + Lp[j + 1], [&](Ti a, Ti b) { return outi[a] < outi[b]; });
+
+			for (Ti s = 0; s < nz; s++)
+				outi[s] = perm[Li[src[s]]];
 		}
 
 		double* outx = out.x.get();
@@ -221,13 +947,13 @@ struct PackedChol
 		{
 			Te* Lx = Le[i].x.get();
 			for (Ti s = 0; s < nz; s++)
-				outx[s] = double(Lx[s]);
+				outx[s] = double(Lx[src[s]]);
 		}
 		else
 		{
 			Tx2* Lx = L.x.get();
 			for (Ti s = 0; s < nz; s++)
-				outx[s] = get(Lx[s], i);
+				outx[s] = get(Lx[src[s]], i);
 		}
 
 		return std::move(out);
@@ -236,54 +962,546 @@ struct PackedChol
 	void solve(Tx2* b, Tx2* out)
 	{
 		pcs_assert(decomposed, "solve: Need to call decompose first.");
-		
+
+		if (perm)
+		{	// solve in the permuted ordering, then permute back
+			Ti m = A.m; Tx2* y = b_perm.get();
+			for (Ti i = 0; i < m; i++)
+				y[i] = b[perm[i]];
+
+			solve_permuted(y, y);
+
+			for (Ti i = 0; i < m; i++)
+				out[perm[i]] = y[i];
+		}
+		else
+			solve_permuted(b, out);
+	}
+
+	void solve_permuted(Tx2* b, Tx2* out)
+	{
+		if (!doubleFactored)
+		{
+			solve_refined(b, out);
+			return;
+		}
+
+		// the refinement needs b, which solve overwrites
+		UniqueAlignedPtr<Tx2> b_copy;
+		if (!refinedIdx.empty() && b == out)
+		{
+			b_copy.reset(pcs_aligned_new<Tx2>(A.m));
+			std::copy(b, b + A.m, b_copy.get());
+			b = b_copy.get();
+		}
+
 		if (!allExact())
+			solve_lanes(b, out);
+		if (hasExact())
+			solve_exact(b, out);
+		if (!refinedIdx.empty())
+			refine_perturbed(b, out);
+	}
+
+	// out = inv(L L') b in the permuted order, for a vector (Tv = Tx2) or a block of vectors (see solveMany).
+	// The subtrees of the elimination tree (see trisolve.h), or else the diagonal blocks of L, are solved in parallel.
+	template <typename Tv>
+	void solve_lanes(Tv* b, Tv* out)
+	{
+		if (const SolveSchedule<Ti>* S = L.solve_tasks())
+		{
+			lsolve(L, *S, b, out);
+			ltsolve(L, *S, out, out);
+		}
+		else
+			L.block_tasks().run([this, b, out](Ti j0, Ti j1, size_t) {
+				lsolve(L, b, out, j0, j1);
+				ltsolve(L, out, out, j0, j1);
+			});
+	}
+
+	// The lanes exactIdx of out = inv(Le Le') b in the permuted order
+	void solve_exact(Tx2* b, Tx2* out)
+	{
+		Ti m = A.m;
+		Te* b_exact = new Te[m];
+		Te* out_exact = new Te[m];
+
+		BlockRanges<Ti> ranges = L_exact.block_tasks();
+		const SolveSchedule<Ti>* S = L_exact.solve_tasks(); // Le shares the pattern of L_exact
+		for (size_t i : exactIdx)
+		{
+			get_slice(b_exact, b, m, i);
+			if (S)
+			{
+				lsolve(Le[i], *S, b_exact, out_exact);
+				ltsolve(Le[i], *S, out_exact, out_exact);
+			}
+			else if (L_exact.nsuper > 0)
+				ranges.run([this, i, b_exact, out_exact](Ti j0, Ti j1, size_t) {
+					lsolve_supernodal(Le[i], L_exact.nsuper, L_exact.super.get(), b_exact, out_exact, j0, j1);
+					ltsolve_supernodal(Le[i], L_exact.nsuper, L_exact.super.get(), out_exact, out_exact, j0, j1);
+				});
+			else
+				ranges.run([this, i, b_exact, out_exact](Ti j0, Ti j1, size_t) {
+					lsolve(Le[i], b_exact, out_exact, j0, j1, L_exact.dense_start);
+					ltsolve(Le[i], out_exact, out_exact, j0, j1, L_exact.dense_start);
+				});
+			set_slice(out, out_exact, m, i);
+		}
+
+		delete[] b_exact;
+		delete[] out_exact;
+	}
+
+	// Refine the lanes refinedIdx of x = inv(L L') b in the permuted order against H = A W A', with L as the
+	// preconditioner (L L' = H + diag(E), see CholOutput::pivot_tol). A lane stops once the correction is
+	// below accuracyThreshold |x|. A lane that stalls is factored in dd_real and solved again (see ensureExact).
+	void refine_perturbed(Tx2* b, Tx2* x)
+	{
+		Ti m = A.m, n = A.n;
+		UniqueAlignedPtr<Tx2> r(pcs_aligned_new<Tx2>(m)), d(pcs_aligned_new<Tx2>(m)), t(pcs_aligned_new<Tx2>(n));
+		Tx2 T0 = Tx2(0.0);
+
+		auto norm = [m](const Tx2* v, size_t l)
+		{
+			Tx ret = 0.0;
+			for (Ti i = 0; i < m; i++)
+				ret = std::max(ret, std::abs(get(v[i], l)));
+			return ret;
+		};
+
+		bool active[k] = {}, stalled[k] = {};
+		Tx d_norm[k];
+		for (size_t l : refinedIdx)
+		{
+			active[l] = true;
+			d_norm[l] = std::numeric_limits<Tx>::infinity();
+		}
+
+		bool any_active = true;
+		for (size_t step = 0; step < maxRefineSteps && any_active; step++)
+		{
+			// r = b - A W A' x
+			for (Ti j = 0; j < n; j++)
+				t[j] = T0;
+			gaxpy(At, x, t.get());
+			for (Ti j = 0; j < n; j++)
+				t[j] = T0 - w[j] * t[j];
+			for (Ti i = 0; i < m; i++)
+				r[i] = b[i];
+			gaxpy(A, t.get(), r.get());
+
+			solve_lanes(r.get(), d.get());
+
+			any_active = false;
+			for (size_t l : refinedIdx)
+			{
+				if (!active[l]) continue;
+
+				Tx d_norm_new = norm(d.get(), l);
+				if (!(d_norm_new <= 0.5 * d_norm[l])) // stalls (or NaN)
+				{
+					active[l] = false;
+					stalled[l] = true;
+					continue;
+				}
+
+				for (Ti i = 0; i < m; i++)
+					set(x[i], l, get(x[i], l) + get(d[i], l));
+				d_norm[l] = d_norm_new;
+				active[l] = (d_norm_new > accuracyThreshold * norm(x, l));
+				any_active |= active[l];
+			}
+		}
+
+		bool any_stalled = false;
+		for (size_t l = 0; l < k; l++)
+		{
+			stalled[l] |= active[l];
+			any_stalled |= stalled[l];
+		}
+
+		if (any_stalled)
 		{
-			lsolve(L, b, out);
-			ltsolve(L, out, out);
+			ensureExact(stalled);
+			solve_exact(b, x);
 		}
+	}
 
+	// logdet and inv(H) of the refined lanes from L. A refined lane has H = L L' - U U' where U has
+	// a column sqrt(E_j) e_j per replaced pivot j (see CholOutput::E). With Y = inv(L L') U and S = I - U' Y = R' R,
+	//		logdet H = logdet L L' + logdet S		(matrix determinant lemma)
+	//		inv(H) = inv(L L') + Z Z', Z = Y inv(R)	(Woodbury)
+	// S has the nonzero eigenvalues of I - inv(L) H inv(L)', whose norm estimateAccuracy keeps below refineLimit,
+	// so R is well conditioned. The lanes with more than maxCorrectionRank pivots or a small pivot in R move to dd_real.
+	void perturbed_correction()
+	{
+		if (correctionReady) return;
+		correctionReady = true;
+
+		Ti m = A.m;
+		Tx2* E = L.E.get();
+		Tx2 T0 = Tx2(0.0);
+		std::vector<Ti> piv[k];
+		bool fallback[k] = {};
+		size_t p = 0;
+		for (size_t l : refinedIdx)
+		{
+			for (Ti j = 0; j < m; j++)
+				if (get(E[j], l) != 0.0)
+					piv[l].push_back(j);
+			fallback[l] = (piv[l].size() > maxCorrectionRank);
+			if (fallback[l])
+				piv[l].clear();
+			p = std::max(p, piv[l].size());
+		}
+
+		// the column t of Y holds the pivot piv[l][t] of every lane l (zero past the pivots of the lane)
+		correctionRank = p;
+		correctionZ.reset(p ? pcs_aligned_new<Tx2>(m * p) : nullptr);
+		Tx2* Z = correctionZ.get();
+		for (size_t t = 0; t < p; t++)
+		{
+			Tx2* Yt = Z + t * m;
+			for (Ti i = 0; i < m; i++)
+				Yt[i] = T0;
+			for (size_t l : refinedIdx)
+				if (t < piv[l].size())
+					set(Yt[piv[l][t]], l, std::sqrt(get(E[piv[l][t]], l)));
+			solve_lanes(Yt, Yt);
+		}
+
+		std::vector<Tx> R;
+		for (size_t l : refinedIdx)
+		{
+			size_t pl = piv[l].size();
+			correctionLogdet[l] = 0.0;
+			if (pl == 0) continue;
+
+			// R = chol(S) stored by columns, S_st = delta_st - sqrt(E_s) Y_t(s)
+			R.assign(pl * pl, 0.0);
+			for (size_t t = 0; t < pl && !fallback[l]; t++)
+			{
+				for (size_t s = 0; s <= t; s++)
+				{
+					Ti j = piv[l][s];
+					Tx v = (s == t ? 1.0 : 0.0) - std::sqrt(get(E[j], l)) * get(Z[t * m + j], l);
+					for (size_t q = 0; q < s; q++)
+						v -= R[s * pl + q] * R[t * pl + q];
+					if (s < t)
+						R[t * pl + s] = v / R[s * pl + s];
+					else if (v > 0.5 * (1.0 - refineLimit)) // the eigenvalues of S are at least 1 - refineLimit
+					{
+						R[t * pl + t] = std::sqrt(v);
+						correctionLogdet[l] += std::log(R[t * pl + t]);
+					}
+					else
+						fallback[l] = true;
+				}
+			}
+
+			// Z = Y inv(R) row by row, zero for the lanes moving to dd_real
+			for (Ti i = 0; i < m; i++)
+				for (size_t t = 0; t < pl; t++)
+				{
+					Tx v = 0.0;
+					if (!fallback[l])
+					{
+						v = get(Z[t * m + i], l);
+						for (size_t q = 0; q < t; q++)
+							v -= get(Z[q * m + i], l) * R[t * pl + q];
+						v /= R[t * pl + t];
+					}
+					set(Z[t * m + i], l, v);
+				}
+		}
+
+		ensureExact(fallback);
+	}
+
+	// out_j -= w_j |Z' a_j|^2, the correction of the leverage scores of the refined lanes (see perturbed_correction)
+	void perturbed_leverage(Tx2* out)
+	{
+		if (refinedIdx.empty() || correctionRank == 0) return;
+
+		Ti m = A.m, n = A.n;
+		UniqueAlignedPtr<Tx2> t(pcs_aligned_new<Tx2>(n));
+		Tx2 T0 = Tx2(0.0);
+		for (size_t s = 0; s < correctionRank; s++)
+		{
+			for (Ti j = 0; j < n; j++)
+				t[j] = T0;
+			gaxpy(At, correctionZ.get() + s * m, t.get());
+			for (Ti j = 0; j < n; j++)
+				out[j] -= w[j] * t[j] * t[j];
+		}
+	}
+
+	// Solve H out_c = b_c for r right hand sides per lane, where b_c = b + c m and out_c = out + c m.
+	// The columns are solved in blocks of solveBlock, so L is read once per block instead of once per column.
+	// The dd_real lanes, the refinement of the perturbed lanes and the mixed precision refinement still
+	// solve one column at a time. out can be b.
+	void solveMany(Tx2* b, Tx2* out, size_t r)
+	{
+		pcs_assert(decomposed, "solveMany: Need to call decompose first.");
+
+		Ti m = A.m;
+		if (!doubleFactored || !refinedIdx.empty())
+		{
+			for (size_t c = 0; c < r; c++)
+				solve(b + c * m, out + c * m);
+			return;
+		}
+
+		// a block is solveBlock consecutive Tx2, the column c of the block at the row i is y[i * R + c]
+		const size_t R = solveBlock;
+		using Tb = FloatArray<Tx2, solveBlock>;
+		static_assert(sizeof(Tb) == solveBlock * sizeof(Tx2), "solveMany: unexpected layout of the block.");
+		UniqueAlignedPtr<Tb> block(pcs_aligned_new<Tb>(m));
+		UniqueAlignedPtr<Tx2> b_c, out_c;
 		if (hasExact())
 		{
-			Ti m = A.m;
-			Te* b_exact = new Te[m];
-			Te* out_exact = new Te[m];
+			b_c.reset(pcs_aligned_new<Tx2>(m));
+			out_c.reset(pcs_aligned_new<Tx2>(m));
+		}
 
-			for (size_t i : exactIdx)
+		Tx2* y = (Tx2*)block.get(), T0 = Tx2(0.0);
+		for (size_t c0 = 0; c0 < r; c0 += R)
+		{
+			size_t nc = std::min(R, r - c0);
+			for (Ti i = 0; i < m; i++)
 			{
-				get_slice(b_exact, b, m, i);
-				lsolve(Le[i], b_exact, out_exact);
-				ltsolve(Le[i], out_exact, out_exact);
-				set_slice(out, out_exact, m, i);
+				Ti pi = perm ? perm[i] : i;
+				for (size_t c = 0; c < R; c++)
+					y[i * R + c] = (c < nc) ? b[(c0 + c) * m + pi] : T0;
 			}
 
-			delete[] b_exact;
-			delete[] out_exact;
+			if (!allExact())
+				solve_lanes(block.get(), block.get());
+
+			for (size_t c = 0; c < nc && hasExact(); c++)
+			{
+				for (Ti i = 0; i < m; i++)
+				{
+					b_c[i] = b[(c0 + c) * m + (perm ? perm[i] : i)];
+					out_c[i] = y[i * R + c];
+				}
+				solve_exact(b_c.get(), out_c.get());
+				for (Ti i = 0; i < m; i++)
+					y[i * R + c] = out_c[i];
+			}
+
+			for (Ti i = 0; i < m; i++)
+			{
+				Ti pi = perm ? perm[i] : i;
+				for (size_t c = 0; c < nc; c++)
+					out[(c0 + c) * m + pi] = y[i * R + c];
+			}
 		}
-	};
+	}
+
+	// Solve H out_c = B(:, c) for every column c of the sparse B (the same right hand side in all lanes),
+	// where out_c = out + c m. The forward solve reads only the columns of L on the paths from the nonzeros
+	// of B(:, c) to the root of the elimination tree (see etree_reach). The backward solve and the dd_real lanes
+	// are dense, and the mixed precision refinement falls back to solve.
+	void solveSparse(const SparseMatrix<Tx, Ti>& B, Tx2* out)
+	{
+		pcs_assert(decomposed, "solveSparse: Need to call decompose first.");
+		pcs_assert(B.m == A.m, "solveSparse: dimensions mismatch.");
+
+		Ti m = A.m, * Bp = B.p.get(), * Bi = B.i.get(); Tx* Bx = B.x.get();
+		std::vector<Ti> pinv(m), s(m), bi;
+		UniquePtr<bool> flag(new bool[m]());
+		for (Ti i = 0; i < m; i++)
+			pinv[perm ? perm[i] : i] = i;
+
+		UniqueAlignedPtr<Tx2> y(pcs_aligned_new<Tx2>(m)), z(pcs_aligned_new<Tx2>(m));
+		Tx2 T0 = Tx2(0.0);
+		for (Ti c = 0; c < B.n; c++)
+		{
+			Tx2* out_c = out + size_t(c) * m;
+			for (Ti i = 0; i < m; i++)
+				y[i] = T0;
+			bi.clear();
+			for (Ti p = Bp[c]; p < Bp[c + 1]; p++)
+			{
+				y[pinv[Bi[p]]] += Tx2(Bx[p]);
+				bi.push_back(pinv[Bi[p]]);
+			}
+
+			if (!doubleFactored)
+			{
+				for (Ti i = 0; i < m; i++)
+					z[i] = y[pinv[i]];
+				solve(z.get(), out_c);
+				continue;
+			}
+
+			if (!allExact())
+			{
+				std::copy(y.get(), y.get() + m, z.get());
+				Ti top = etree_reach(L.parent.get(), m, bi.data(), Ti(bi.size()), s.data(), flag.get());
+				lsolve_reach(L, s.data(), top, z.get(), L.dense_start);
+				if (const SolveSchedule<Ti>* S = L.solve_tasks())
+					ltsolve(L, *S, z.get(), z.get());
+				else
+				{
+					Tx2* zp = z.get();
+					L.block_tasks().run([this, zp](Ti j0, Ti j1, size_t) {
+						ltsolve(L, zp, zp, j0, j1);
+					});
+				}
+			}
+			if (hasExact())
+				solve_exact(y.get(), z.get());
+			if (!refinedIdx.empty())
+				refine_perturbed(y.get(), z.get());
+
+			for (Ti i = 0; i < m; i++)
+				out_c[perm ? perm[i] : i] = z[i];
+		}
+	}
+
+	// Solve with Lf and refine with the residual b - H x in double.
+	// The lanes that do not converge are solved again with L (and Le).
+	void solve_refined(Tx2* b, Tx2* out)
+	{
+		Ti m = A.m, * Hp = H.p.get(), * Hi = H.i.get();
+		Tx2* Hx = H.x.get(), * x = refine_x.get(), * r = refine_r.get();
+		Tf2* d = refine_d.get();
+
+		auto norm = [&](const Tx2* v, size_t l)
+		{
+			Tx ret = 0.0;
+			for (Ti i = 0; i < m; i++)
+				ret = std::max(ret, std::abs(get(v[i], l)));
+			return ret;
+		};
+
+		Tx b_norm[k], r_norm[k];
+		bool active[k], stalled[k];
+		for (size_t l = 0; l < k; l++)
+		{
+			b_norm[l] = r_norm[l] = norm(b, l);
+			active[l] = (b_norm[l] > 0.0);
+			stalled[l] = false;
+		}
+
+		Tx2 T0 = Tx2(0.0);
+		for (Ti i = 0; i < m; i++)
+		{
+			x[i] = T0;
+			r[i] = b[i];
+		}
+
+		bool any_active = true;
+		for (size_t step = 0; step < maxRefineSteps && any_active; step++)
+		{
+			// x += H^{-1} r with the residual scaled to 1 to stay in the range of float
+			for (Ti i = 0; i < m; i++)
+				for (size_t l = 0; l < k; l++)
+					set(d[i], l, active[l] ? float(get(r[i], l) / r_norm[l]) : 0.0f);
+
+			{
+				FlushDenormals ftz;
+				if (const SolveSchedule<Ti>* S = Lf.solve_tasks())
+				{
+					lsolve(Lf, *S, d, d);
+					ltsolve(Lf, *S, d, d);
+				}
+				else
+				{
+					lsolve(Lf, d, d);
+					ltsolve(Lf, d, d);
+				}
+			}
+
+			for (Ti i = 0; i < m; i++)
+				for (size_t l = 0; l < k; l++)
+					if (active[l]) set(x[i], l, get(x[i], l) + double(get(d[i], l)) * r_norm[l]);
+
+			// r = b - H x, each entry of the lower triangle of H is used for H(i, j) and H(j, i)
+			for (Ti i = 0; i < m; i++)
+				r[i] = b[i];
+			for (Ti j = 0; j < m; j++)
+			{
+				Tx2 xj = x[j];
+				for (Ti s = Hp[j]; s < Hp[j + 1]; s++)
+				{
+					Ti i = Hi[s];
+					fnmadd(r[i], Hx[s], xj);
+					if (i != j) fnmadd(r[j], Hx[s], x[i]);
+				}
+			}
+
+			any_active = false;
+			for (size_t l = 0; l < k; l++)
+			{
+				if (!active[l]) continue;
+
+				Tx r_norm_new = norm(r, l);
+				if (r_norm_new <= refineTolerance * (Hnorm[l] * norm(x, l) + b_norm[l]))
+					active[l] = false;
+				else if (!(r_norm_new <= 0.5 * r_norm[l])) // stalls (or NaN)
+				{
+					active[l] = false;
+					stalled[l] = true;
+				}
+				r_norm[l] = r_norm_new;
+				any_active |= active[l];
+			}
+		}
+
+		bool any_stalled = false;
+		for (size_t l = 0; l < k; l++)
+		{
+			stalled[l] |= active[l];
+			any_stalled |= stalled[l];
+		}
+
+		if (any_stalled)
+		{
+			ensureDouble();
+			solve_permuted(b, r);
+			for (Ti i = 0; i < m; i++)
+				for (size_t l = 0; l < k; l++)
+					if (stalled[l]) set(x[i], l, get(r[i], l));
+		}
+
+		for (Ti i = 0; i < m; i++)
+			out[i] = x[i];
+	}
 
 	void leverageScoreComplement(Tx2* out)
 	{
 		pcs_assert(decomposed, "leverageScoreComplement: Need to call decompose first.");
+		ensureDouble();
+		perturbed_correction();
 		
 		Ti n = A.n, m = A.m;
 
 		if (!allExact())
 		{
 			Tx2 T1 = Tx2(1.0), T2 = Tx2(2.0);
-			leverage(diagP, L, A, At);
+			diagP.Hinv.scratch_dir = scratchDir;
+			diagP.Hinv.dense_start = L.dense_start;
+			leverage(diagP, L, A, At, L.block_tasks());
 
 			Tx2* tau = diagP.x.get();
 			for (Ti j = 0; j < n; j++)
 				out[j] = T1 - tau[j] * w[j];
+			perturbed_leverage(out);
 		}
 
 		if (hasExact())
 		{
 			Te T1 = Te(1.0), T2 = Te(2.0);
+			diagP_exact.Hinv.scratch_dir = scratchDir;
+			diagP_exact.Hinv.dense_start = L_exact.dense_start;
 			for (size_t i : exactIdx)
 			{
-				leverage(diagP_exact, Le[i], A, At);
+				leverage(diagP_exact, Le[i], A, At, L_exact.block_tasks());
 
 				Te* tau = diagP_exact.x.get();
 				for (Ti j = 0; j < n; j++)
@@ -295,22 +1513,29 @@ struct PackedChol
 	void leverageScoreComplementJL(Tx2* out, size_t JL_k)
 	{
 		pcs_assert(decomposed, "leverageScoreComplementJL: Need to call decompose first.");
+		ensureDouble();
+		perturbed_correction();
 		
 		Ti m = A.m, n = A.n;
 
 		if (!allExact())
 		{
 			Tx2 T1 = Tx2(1.0), T2 = Tx2(2.0);
+			diagPJL.schedule = L.solve_tasks();
+			diagPJL.dense_start = L.dense_start;
 			leverageJL(diagPJL, L, A, At, JL_k);
 
 			Tx2* tau = diagPJL.x.get();
 			for (Ti j = 0; j < n; j++)
 				out[j] = T1 - tau[j] * w[j];
+			perturbed_leverage(out);
 		}
 
 		if (hasExact())
 		{
 			Te T1 = Te(1.0), T2 = Te(2.0);
+			diagPJL_exact.schedule = L_exact.solve_tasks();
+			diagPJL_exact.dense_start = L_exact.dense_start;
 			for (size_t i : exactIdx)
 			{
 				leverageJL(diagPJL_exact, Le[i], A, At, JL_k);
@@ -325,7 +1550,11 @@ struct PackedChol
 	Tx2 estimateAccuracy()
 	{
 		pcs_assert(decomposed, "estimateAccuracy: Need to call decompose first.");
+		ensureDouble();
 		
+		// L is measured against H, so the replaced pivots (see CholOutput::pivot_tol) count as error
+		diagPJL.schedule = L.solve_tasks();
+		diagPJL.dense_start = L.dense_start;
 		return cholAccuracy(diagPJL, L, A, At, w.get());
 	}
 };
\ No newline at end of file
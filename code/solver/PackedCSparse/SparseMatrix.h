@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
 #include "FloatArray.h"
@@ -10,15 +11,31 @@ namespace PackedCSparse {
 			throw std::logic_error(message);
 	}
 
+	// The words before an aligned array: how to free the block that contains it
+	struct AlignedHeader
+	{
+		void (*release)(void* block, size_t bytes);	// frees the block (nullptr for new char[])
+		size_t bytes;								// size of the block
+		void* block;								// start of the block
+	};
+
+	// Place an array aligned to the cache line inside block, which has room for alignment and the header
+	template <typename T>
+	T* pcs_aligned_init(void* block, size_t bytes, void (*release)(void*, size_t))
+	{
+		size_t alignment = 64; // size of memory cache line
+		AlignedHeader* h = (AlignedHeader*)(((size_t)(block) + alignment - 1 + sizeof(AlignedHeader)) & ~(alignment - 1)) - 1;
+		h->release = release;
+		h->bytes = bytes;
+		h->block = block;
+		return (T*)(h + 1);
+	}
+
 	template <typename T>
 	T* pcs_aligned_new(size_t size)
 	{
-		int alignment = 64; // size of memory cache line
-		int offset = alignment - 1 + sizeof(void*);
-		void* p1 = (void*)new char[size * sizeof(T) + offset];
-		void** p2 = (void**)(((size_t)(p1)+offset) & ~(alignment - 1));
-		p2[-1] = p1;
-		return (T*)p2;
+		size_t bytes = size * sizeof(T) + 63 + sizeof(AlignedHeader);
+		return pcs_aligned_init<T>(new char[bytes], bytes, nullptr);
 	}
 
 	template <typename T>
@@ -26,7 +43,11 @@ namespace PackedCSparse {
 	{
 		void operator()(T* p) const
 		{
-			delete[](char*)(((void**)p)[-1]);
+			AlignedHeader* h = (AlignedHeader*)p - 1;
+			if (h->release)
+				h->release(h->block, h->bytes);
+			else
+				delete[](char*)(h->block);
 		}
 	};
 
@@ -36,6 +57,41 @@ namespace PackedCSparse {
 	template<typename T>
 	using UniquePtr = std::unique_ptr<T[]>;
 
+	// An array with shared ownership. It is used like UniquePtr, but copies point to the same array
+	// so that read only data (e.g. a sparsity pattern) can be shared among several objects.
+	template<typename T>
+	struct SharedPtr : std::shared_ptr<T>
+	{
+		SharedPtr() = default;
+
+		explicit SharedPtr(T* p)
+		{
+			reset(p);
+		}
+
+		SharedPtr(UniquePtr<T>&& p)
+		{
+			reset(p.release());
+		}
+
+		// points to p inside an array owned by owner (e.g. a memory mapped file)
+		template <typename Owner>
+		SharedPtr(const std::shared_ptr<Owner>& owner, T* p) : std::shared_ptr<T>(owner, p) {}
+
+		void reset(T* p = nullptr)
+		{
+			if (p)
+				std::shared_ptr<T>::reset(p, std::default_delete<T[]>());
+			else
+				std::shared_ptr<T>::reset();
+		}
+
+		T& operator[](std::ptrdiff_t k) const
+		{
+			return this->get()[k];
+		}
+	};
+
 	// Tx = Type for entries, Ti = Type for indices.
 	// if Tx == bool, the matrix stores only sparsity information
 	template <typename Tx, typename Ti>
@@ -43,8 +99,8 @@ namespace PackedCSparse {
 	{
 		Ti m = 0;					/* number of rows */
 		Ti n = 0;					/* number of columns */
-		UniquePtr<Ti> p;			/* column pointers (size n+1) */
-		UniquePtr<Ti> i;			/* row indices, size nnz */
+		SharedPtr<Ti> p;			/* column pointers (size n+1), can be shared with other matrices */
+		SharedPtr<Ti> i;			/* row indices, size nnz, can be shared with other matrices */
 		UniqueAlignedPtr<Tx> x;		/* numerical values, size nnz */
 
 		SparseMatrix() = default;
@@ -143,22 +199,46 @@ namespace PackedCSparse {
 		return D;
 	}
 
+	// Check that the columns t, ..., n-1 of L are dense with sorted rows, i.e. L(i, j) for i >= j >= t
+	// are all stored and the entry (i, j) is at L.x[L.p[j] + i - j].
+	template <typename Tx, typename Ti>
+	bool is_dense_tail(const SparseMatrix<Tx, Ti>& L, Ti t)
+	{
+		Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get();
+		for (Ti j = t; j < n; j++)
+		{
+			if (Lp[j + 1] - Lp[j] != n - j) return false;
+			for (Ti s = Lp[j]; s < Lp[j + 1]; s++)
+				if (Li[s] != j + (s - Lp[j])) return false;
+		}
+		return true;
+	}
+
 	// Solve L out = x
 	// Input: L in Tx^{n by n}, x in Tx2^{n}
 	// Output: out in Tx2^{n}.
 	// If out is provided, we will output to out. Else, output to x.
+	// Every column is solved with its row indices, a factor passes its dense trailing block (see CholOutput::dense_start).
 	template <typename Tx, typename Ti, typename Tx2>
 	void lsolve(const SparseMatrix<Tx, Ti>& L, Tx2* x, Tx2* out = nullptr)
 	{
 		pcs_assert(L.initialized(), "lsolve: bad inputs.");
 		pcs_assert(L.n == L.m, "lsolve: dimensions mismatch.");
 
+		lsolve(L, x, out ? out : x, Ti(0), L.n, L.n);
+	}
+
+	// Solve L out = x on the rows j0, ..., j1-1, which must be a union of diagonal blocks of L.
+	// Only the entries j0, ..., j1-1 of x and out are used, so the blocks can be solved in parallel.
+	// The columns t, ..., n-1 are a dense trailing block (see is_dense_tail), t = n if there is none.
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve(const SparseMatrix<Tx, Ti>& L, Tx2* x, Tx2* out, Ti j0, Ti j1, Ti t)
+	{
 		Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
 
-		if (!out) out = x;
-		if (x != out) std::copy(x, x + n, out);
+		if (x != out) std::copy(x + j0, x + j1, out + j0);
 
-		for (Ti j = 0; j < n; j++)
+		for (Ti j = j0; j < std::min(j1, t); j++)
 		{
 			Tx2 out_j = out[j] / Lx[Lp[j]];
 			out[j] = out_j;
@@ -169,24 +249,82 @@ namespace PackedCSparse {
 				fnmadd(out[Li[p]], out_j, Lx[p]);
 			}
 		}
+
+		// the dense trailing block without the row indices
+		for (Ti j = std::max(j0, t); j < j1; j++)
+		{
+			Tx* Lj = Lx + Lp[j] - j;
+			Tx2 out_j = out[j] / Lj[j];
+			out[j] = out_j;
+
+			for (Ti i = j + 1; i < n; i++)
+				fnmadd(out[i], out_j, Lj[i]);
+		}
+	}
+
+	// Solve L out = out for a sparse out, which is zero outside of the columns s[top], ..., s[n-1].
+	// The columns must contain the pattern of L^{-1} out with every column before its ancestors (see etree_reach),
+	// so only these columns of L are read. The columns t, ..., n-1 are a dense trailing block (see lsolve).
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve_reach(const SparseMatrix<Tx, Ti>& L, const Ti* s, Ti top, Tx2* out, Ti t)
+	{
+		Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
+
+		for (Ti q = top; q < n; q++)
+		{
+			Ti j = s[q];
+			Tx2 out_j = out[j] / Lx[Lp[j]];
+			out[j] = out_j;
+
+			if (j < t)
+			{
+				for (Ti p = Lp[j] + 1; p < Lp[j + 1]; p++)
+					fnmadd(out[Li[p]], out_j, Lx[p]);
+			}
+			else
+			{	// the dense trailing block without the row indices
+				Tx* Lj = Lx + Lp[j] - j;
+				for (Ti i = j + 1; i < n; i++)
+					fnmadd(out[i], out_j, Lj[i]);
+			}
+		}
 	}
 
 	// Solve L' out = x
 	// Input: L in Tx^{n by n}, x in Tx2^{n}
 	// Output: out in Tx2^{n}.
 	// If out is provided, we will output to out. Else, output to x.
+	// Every column is solved with its row indices, a factor passes its dense trailing block (see CholOutput::dense_start).
 	template <typename Tx, typename Ti, typename Tx2>
 	void ltsolve(const SparseMatrix<Tx, Ti>& L, Tx2* x, Tx2* out = nullptr)
 	{
 		pcs_assert(L.initialized(), "ltsolve: bad inputs.");
 		pcs_assert(L.n == L.m, "ltsolve: dimensions mismatch.");
 
+		ltsolve(L, x, out ? out : x, Ti(0), L.n, L.n);
+	}
+
+	// Solve L' out = x on the rows j0, ..., j1-1, which must be a union of diagonal blocks of L.
+	// The columns t, ..., n-1 are a dense trailing block (see lsolve).
+	template <typename Tx, typename Ti, typename Tx2>
+	void ltsolve(const SparseMatrix<Tx, Ti>& L, Tx2* x, Tx2* out, Ti j0, Ti j1, Ti t)
+	{
 		Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
 
-		if (!out) out = x;
-		if (x != out) std::copy(x, x + n, out);
+		if (x != out) std::copy(x + j0, x + j1, out + j0);
+
+		for (Ti j = j1 - 1; j >= std::max(j0, t); j--)
+		{
+			Tx* Lj = Lx + Lp[j] - j;
+			Tx2 out_j = out[j];
+
+			for (Ti i = j + 1; i < n; i++)
+				fnmadd(out_j, out[i], Lj[i]);
+
+			out[j] = out_j / Tx2(Lj[j]);
+		}
 
-		for (Ti j = n - 1; j != -1; j--)
+		for (Ti j = std::min(j1, t) - 1; j >= j0; j--)
 		{
 			Tx2 out_j = out[j];
 
@@ -200,6 +338,116 @@ namespace PackedCSparse {
 		}
 	}
 
+	// Solve with the supernode of the columns f, ..., f+ns-1 in lsolve_supernodal: the dense triangle,
+	// then the rows R[ns], ..., R[r_end-1] of the block below, where R are the rows of the column f.
+	// The block is applied row by row, which reads out[i] once per row instead of once per entry.
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve_supernode(const SparseMatrix<Tx, Ti>& L, Ti f, Ti ns, Ti r_end, Tx2* out)
+	{
+		Ti* Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
+		Ti* R = Li + Lp[f];
+
+		// the triangle, Lc[r] = L(R[r], f + c)
+		for (Ti c = 0; c < ns; c++)
+		{
+			Tx* Lc = Lx + Lp[f + c] - c;
+			Tx2 out_c = out[f + c] / Lc[c];
+			out[f + c] = out_c;
+
+			for (Ti r = c + 1; r < ns; r++)
+				fnmadd(out[f + r], out_c, Lc[r]);
+		}
+
+		// the block below
+		for (Ti r = ns; r < r_end; r++)
+		{
+			Tx2 out_r = out[R[r]];
+			for (Ti c = 0; c < ns; c++)
+				fnmadd(out_r, out[f + c], Lx[Lp[f + c] + r - c]);
+			out[R[r]] = out_r;
+		}
+	}
+
+	// Solve L' out = x with the supernode of the columns f, ..., f+ns-1 in ltsolve_supernodal
+	template <typename Tx, typename Ti, typename Tx2>
+	void ltsolve_supernode(const SparseMatrix<Tx, Ti>& L, Ti f, Ti ns, Tx2* out)
+	{
+		Ti* Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
+		Ti nr = Lp[f + 1] - Lp[f], * R = Li + Lp[f];
+
+		// the block below
+		for (Ti r = ns; r < nr; r++)
+		{
+			Tx2 out_r = out[R[r]];
+			for (Ti c = 0; c < ns; c++)
+				fnmadd(out[f + c], out_r, Lx[Lp[f + c] + r - c]);
+		}
+
+		// the triangle
+		for (Ti c = ns - 1; c >= 0; c--)
+		{
+			Tx* Lc = Lx + Lp[f + c] - c;
+			Tx2 out_c = out[f + c];
+
+			for (Ti r = c + 1; r < ns; r++)
+				fnmadd(out_c, out[f + r], Lc[r]);
+
+			out[f + c] = out_c / Tx2(Lc[c]);
+		}
+	}
+
+	// Solve L out = x on the rows j0, ..., j1-1 (see lsolve) with the supernodes of L.
+	// The columns super[s], ..., super[s+1]-1 share the rows of the first one from their diagonal on
+	// (see CholOutput::super), so a supernode is a dense triangle over a dense block with one row index per row
+	// (see lsolve_supernode). The columns super[nsuper], ..., n-1 are the dense trailing block.
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve_supernodal(const SparseMatrix<Tx, Ti>& L, Ti nsuper, const Ti* super, Tx2* x, Tx2* out, Ti j0, Ti j1)
+	{
+		Ti n = L.n, * Lp = L.p.get(); Tx* Lx = L.x.get();
+
+		if (x != out) std::copy(x + j0, x + j1, out + j0);
+
+		for (Ti s = Ti(std::lower_bound(super, super + nsuper, j0) - super); s < nsuper && super[s] < j1; s++)
+		{
+			Ti f = super[s];
+			lsolve_supernode(L, f, super[s + 1] - f, Lp[f + 1] - Lp[f], out);
+		}
+
+		for (Ti j = std::max(j0, super[nsuper]); j < j1; j++)
+		{
+			Tx* Lj = Lx + Lp[j] - j;
+			Tx2 out_j = out[j] / Lj[j];
+			out[j] = out_j;
+
+			for (Ti i = j + 1; i < n; i++)
+				fnmadd(out[i], out_j, Lj[i]);
+		}
+	}
+
+	// Solve L' out = x on the rows j0, ..., j1-1 with the supernodes of L (see lsolve_supernodal)
+	template <typename Tx, typename Ti, typename Tx2>
+	void ltsolve_supernodal(const SparseMatrix<Tx, Ti>& L, Ti nsuper, const Ti* super, Tx2* x, Tx2* out, Ti j0, Ti j1)
+	{
+		Ti n = L.n, * Lp = L.p.get(); Tx* Lx = L.x.get();
+
+		if (x != out) std::copy(x + j0, x + j1, out + j0);
+
+		for (Ti j = j1 - 1; j >= std::max(j0, super[nsuper]); j--)
+		{
+			Tx* Lj = Lx + Lp[j] - j;
+			Tx2 out_j = out[j];
+
+			for (Ti i = j + 1; i < n; i++)
+				fnmadd(out_j, out[i], Lj[i]);
+
+			out[j] = out_j / Tx2(Lj[j]);
+		}
+
+		Ti s0 = Ti(std::lower_bound(super, super + nsuper, j0) - super);
+		for (Ti s = Ti(std::lower_bound(super, super + nsuper, j1) - super) - 1; s >= s0; s--)
+			ltsolve_supernode(L, super[s], super[s + 1] - super[s], out);
+	}
+
 	// Update y <-- y + A x
 	// Input: A in Tx^{n by n}, x, y in Tx2^{n}
 	template <typename Tx, typename Ti, typename Tx2>
@@ -1,8 +1,15 @@
 #pragma once
 #include <vector>
 #include <queue>
+#include <chrono>
+#include <memory>
 #include "SparseMatrix.h"
 #include "transpose.h"
+#include "multiply.h"
+#include "etree.h"
+#include "parallel.h"
+#include "scratch.h"
+#include "trisolve.h"
 
 // Problem:
 // Compute chol(A)
@@ -13,24 +20,135 @@
 // chol_up_looking:
 //		Compute L row by row
 //		This is faster when it is compute bound.
+//		Each row is a sparse triangular solve with the rows above it, using the pattern Lt.
 //
 // chol_left_looking:
 //		Compute L col by col
 //		This is faster when it is memory bound.
+//
+// chol_supernodal:
+//		Group columns with (almost) the same pattern into supernodes and
+//		compute L supernode by supernode. Each descendant updates a whole
+//		column of the supernode with a dense loop and only the final scatter
+//		uses indirect indices. The pattern of L is padded with explicit zeros
+//		such that every column of a supernode has the same rows below it.
+//		With a thread pool, the elimination tree is split into independent subtrees which are
+//		factorized in parallel, and the remaining top supernodes are factorized afterwards.
+//		lsolve and ltsolve of a factor with supernodes use them too (lsolve_supernodal).
+//
+// chol_multifrontal:
+//		Visit the supernodes in postorder. Each supernode forms a dense frontal matrix from A and
+//		the update matrices of its children (extend-add), factorizes its own columns and pushes
+//		the Schur complement as its update matrix on a stack. It uses the same padded pattern
+//		as chol_supernodal and is faster when the separators are wide.
+//
+// chol_dense:
+//		When the trailing columns of L are nearly dense, the symbolic analysis stores them as a dense
+//		block (dense_start). The kernels stop before the block, then the block is assembled and
+//		factorized with a cache-blocked dense cholesky that does not use any row index.
+//		lsolve, ltsolve and projinv use dense loops on the same block.
+//
+// chol_analyze:
+//		The column counts give nnz(L) and the flops of every kernel in O(nnz(H) alpha(n)), so the
+//		ordering and the lane width can be chosen before any factorization.
+//
+// Diagonal blocks:
+//		A column whose parent chain never leaves a range of columns starts no dependency outside it,
+//		so L is block diagonal with a block per connected component of H if the rows of each component
+//		are contiguous. The up-looking, left-looking and multifrontal kernels, the triangular solves and
+//		projinv run groups of blocks on the pool (block_tasks). chol_supernodal splits the tree itself.
+//		The triangular solves of PackedChol split the tree into subtrees instead (solve_tasks, trisolve.h),
+//		along the supernodes if L has them, and solve each supernode with the dense kernels.
+//
+// Static pivoting:
+//		With pivot_tol > 0, a pivot d <= pivot_tol * H_jj is replaced by pivot_tol * H_jj instead of
+//		failing the lane, so L is the factor of H + diag(E) for a small diagonal E. The count of
+//		replaced pivots is kept per lane (npert). We keep L L' instead of L D L' as D = diag(L)^2.
+//
+// Assembly:
+//		The kernels read the columns of A through a column source. StoredColumns reads a stored
+//		matrix. FusedColumns builds the column j of H = A diag(w) A' from A and A' right before
+//		it is needed, so that H is never stored and only its lower (or upper) part is computed.
+//
+// chol_autotune:
+//		Which kernel wins depends on the pattern of A, on the lane width and on the machine.
+//		The first calls rotate through all kernels (each with its own symbolic analysis) and
+//		time them. Afterwards the fastest kernel is kept and the other factors are freed.
 
 
 namespace PackedCSparse {
+	enum class CholMethod
+	{
+		LeftLooking = 0,
+		Supernodal = 1,
+		Multifrontal = 2,
+		UpLooking = 3,
+		Auto = 4 // pick the fastest of the above with chol_autotune
+	};
+
 	template <typename Tx, typename Ti>
 	struct CholOutput : SparseMatrix<Tx, Ti>
 	{
-		TransposeOutput<bool, Ti> Lt;	// sparsity pattern of the Lt
-		UniquePtr<Ti> diag;				// the index for diagonal element. Ax[diag[k]] is A_kk
+		CholMethod method = CholMethod::LeftLooking;
+
+		// The pattern of L and the symbolic arrays (SharedPtr) are read only after initialize and can be shared (see share)
+		TransposeOutput<bool, Ti> Lt;	// sparsity pattern of the Lt (only for CholMethod::LeftLooking and CholMethod::UpLooking)
+		SharedPtr<Ti> diag;				// the index for diagonal element. Ax[diag[k]] is A_kk
+		SharedPtr<Ti> parent;			// the elimination tree
 		UniquePtr<Ti> c;				// c[i] = index the last nonzero on column i in the current L
 		UniqueAlignedPtr<Tx> w;			// the row of L we are computing
 
-		// The cost of this is roughly 3 times larger than chol
-		// One can optimize it by using other data structure
-		void initialize(const SparseMatrix<Tx, Ti>& A)
+		// diagonal blocks, one for each connected component of the graph of A (if its rows are grouped)
+		Ti nblocks = 0;
+		SharedPtr<Ti> block_p;			// the b-th block is the columns block_p[b], ..., block_p[b+1]-1
+
+		// dense trailing block
+		Ti dense_start = 0;				// the columns dense_start, ..., n-1 of L are stored dense and factorized by chol_dense
+		double dense_ratio = 0.95;		// the smallest fraction of nonzeros in the trailing block to store it dense
+		Ti dense_min = 64;				// the smallest dense trailing block
+
+		// static pivoting: a pivot d <= pivot_tol * H_jj is replaced by pivot_tol * H_jj (by 1e128 if that is 0)
+		double pivot_tol = 0.0;
+		UniqueAlignedPtr<Tx> npert;		// npert[0] = the number of replaced pivots of each lane in the last factorization
+		UniqueAlignedPtr<Tx> Hdiag;		// Hdiag[j] = H_jj
+		UniqueAlignedPtr<Tx> E;			// L L' = H + diag(E) where E[j] is 0 unless the pivot j was replaced
+
+		// out of core: if not empty, the values of L are in a scratch file in this directory (see scratch.h)
+		std::string scratch_dir;
+
+		// supernodes (only for CholMethod::Supernodal and CholMethod::Multifrontal)
+		Ti nsuper = 0;
+		SharedPtr<Ti> super;			// the s-th supernode is the columns super[s], ..., super[s+1]-1
+		SharedPtr<Ti> update_p;			// update_p[s], ..., update_p[s+1]-1 are the updates for the s-th supernode
+		SharedPtr<Ti> update_k;			// the supernode giving the update
+		SharedPtr<Ti> update_s;			// the first row of the update as a position in the pattern of update_k
+		UniquePtr<Ti> map;				// map[i] = position of the row i in the pattern of the current supernode
+
+		// multifrontal (only for CholMethod::Multifrontal)
+		SharedPtr<Ti> spost;			// postorder of the supernodal elimination tree
+		SharedPtr<Ti> nchild;			// number of children of each supernode
+		size_t stack_size = 0;			// the peak size of the stack
+		UniqueAlignedPtr<Tx> stack;		// stack of the update matrices
+
+		// parallel factorization (only for CholMethod::Supernodal)
+		std::shared_ptr<ThreadPool> pool;	// null means single threaded
+		size_t task_threads = 0;			// the pool size the tasks are built for
+		Ti ntasks = 0;
+		UniquePtr<Ti> task_p;				// task_p[t], ..., task_p[t+1]-1 are the supernodes of the t-th subtree,
+		UniquePtr<Ti> task_s;				// the last one (t = ntasks) is the top of the tree run after all subtrees
+		UniqueAlignedPtr<Tx> w_thread;		// w for each thread
+		UniquePtr<Ti> map_thread;			// map for each thread
+		UniqueAlignedPtr<Tx> npert_thread;	// npert for each thread
+		UniqueAlignedPtr<Tx> stack_thread;	// stack for each thread (only for CholMethod::Multifrontal, see chol_blocks)
+
+		// parallel triangular solves, built for the pool on first use (see solve_tasks)
+		SolveSchedule<Ti> solve_schedule;
+
+		// Symbolic analysis: elimination tree, column counts, then one allocation of L.
+		// The pattern of L is filled row by row via the row subtrees, which costs O(nnz(L)).
+		// Only the pattern of A is used.
+		template <typename Tx2>
+		void initialize(const SparseMatrix<Tx2, Ti>& A)
 		{
 			pcs_assert(A.initialized(), "chol: bad inputs.");
 			pcs_assert(A.n == A.m, "chol: dimensions mismatch.");
@@ -38,120 +156,792 @@ namespace PackedCSparse {
 			Ti n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
 
 			// initialize
+			solve_schedule = SolveSchedule<Ti>();
 			this->diag.reset(new Ti[n]);
 			this->c.reset(new Ti[n]);
 			this->w.reset(pcs_aligned_new<Tx>(n));
+			this->Hdiag.reset(pcs_aligned_new<Tx>(n));
+			this->E.reset(pcs_aligned_new<Tx>(n));
+			this->npert.reset(pcs_aligned_new<Tx>(1));
 
-			// compute the sparsity pattern of L and diag
-			using queue = std::priority_queue<Ti, std::vector<Ti>, std::greater<Ti>>;
-			queue q; // sol'n of the current row of L
-			Ti* mark = new Ti[n]; // used to prevent same indices push to q twice
-			std::vector<Ti>* cols = new std::vector<Ti>[n]; // stores the non-zeros of each col of L
-			Ti nz = 0, Anz = Ap[n];
-
+			// diag[i] = the first entry of A_{i:n, i}
 			for (Ti i = 0; i < n; i++)
-				mark[i] = -1;
+			{
+				Ti s = Ap[i];
+				while (s < Ap[i + 1] && Ai[s] < i) s++;
+				this->diag[i] = s; // if the column has no diagonal, A_{i:n, i} is empty and L_ii is clipped
+			}
+
+			UniquePtr<Ti> colcount = stored_counts(A);
+			Ti* cnt = colcount.get();
+			bool supernodal = (method == CholMethod::Supernodal || method == CholMethod::Multifrontal);
+
+			// allocate L
+			Ti nz = 0;
+			for (Ti j = 0; j < n; j++)
+				nz += cnt[j];
+			SparseMatrix<Tx, Ti>::initialize(n, n, nz);
+			if (!std::is_same<Tx, bool>::value && !scratch_dir.empty())
+				this->x.reset(pcs_scratch_new<Tx>(nz > 0 ? nz : 1, scratch_dir));
 
-			// for each row of A
+			Ti* Lp = this->p.get(), * Li = this->i.get(), * c = this->c.get();
+			Lp[0] = 0;
+			for (Ti j = 0; j < n; j++)
+			{
+				Lp[j + 1] = Lp[j] + cnt[j];
+				c[j] = Lp[j];
+			}
+
+			// fill the pattern of L row by row
+			Ti* s = new Ti[n], * flag = new Ti[n];
+			Ti* first = supernodal ? new Ti[n] : nullptr; // first[j] = the first column of the supernode of j
+			Ti ds = dense_start;
 			for (Ti i = 0; i < n; i++)
-			{	// push i-th row of A, called a_12, into mark
-				Ti s;
-				for (s = Ap[i]; s < Ap[i + 1]; s++)
-				{
-					Ti j = Ai[s];
-					if (j >= i) break;
+				flag[i] = -1;
+			if (supernodal)
+			{
+				for (Ti J = 0; J < nsuper; J++)
+					for (Ti j = super[J]; j < super[J + 1]; j++)
+						first[j] = super[J];
+				for (Ti j = ds; j < n; j++)
+					first[j] = j;
+			}
 
-					q.push(j);
-					mark[j] = i;
+			for (Ti k = 0; k < n; k++)
+			{
+				Ti top = ereach(A, k, this->parent.get(), s, flag);
+				if (k >= ds)
+				{	// the sparse part of the row k and then the dense trailing block
+					for (Ti t = top; t < n; t++)
+					{
+						Ti j = s[t];
+						if (j >= ds || (supernodal && j + 1 < ds && first[j + 1] == first[j])) continue;
+						for (Ti jj = supernodal ? first[j] : j; jj <= j; jj++)
+							Li[c[jj]++] = k;
+					}
+					for (Ti j = ds; j < k; j++)
+						Li[c[j]++] = k;
+				}
+				else if (!supernodal)
+				{
+					for (Ti t = top; t < n; t++)
+						Li[c[s[t]]++] = k;
 				}
-				if (s >= Anz) // this case happens only if the diagonal is 0. No cholesky in this case.
-					this->diag[i] = 0;
 				else
-					this->diag[i] = s;
+				{
+					// the dense triangle of the supernode containing k
+					for (Ti j = first[k]; j < k; j++)
+						Li[c[j]++] = k;
+
+					// the row k appears in the supernode iff it appears in its last column
+					for (Ti t = top; t < n; t++)
+					{
+						Ti j = s[t];
+						if (first[j] == first[k] || (j + 1 < n && first[j + 1] == first[j])) continue;
+						for (Ti jj = first[j]; jj <= j; jj++)
+							Li[c[jj]++] = k;
+					}
+				}
+				Li[c[k]++] = k;
+			}
+			delete[] s; delete[] flag; delete[] first;
+			pcs_assert(is_dense_tail(*this, ds), "chol: the dense trailing block is not sorted.");
+
+			// the dense trailing block is a chain in the elimination tree
+			for (Ti j = ds; j < n; j++)
+				this->parent[j] = (j + 1 < n) ? j + 1 : -1;
+
+			// a block ends at j if no column up to j has its parent after j
+			std::vector<Ti> bp(1, 0);
+			Ti reach = -1;
+			for (Ti j = 0; j < n; j++)
+			{
+				reach = std::max(reach, this->parent[j]);
+				if (reach <= j) bp.push_back(j + 1);
+			}
+			nblocks = Ti(bp.size()) - 1;
+			block_p.reset(new Ti[bp.size()]);
+			std::copy(bp.begin(), bp.end(), block_p.get());
+
+			if (!supernodal)
+				this->Lt = transpose<Tx, Ti, bool>(*this);
+
+			// initialize w to 0
+			Tx Tv0 = Tx(0);
+			for (Ti k = 0; k < n; k++)
+				w[k] = Tv0;
+
+			if (method == CholMethod::Supernodal)
+				initialize_updates();
+			else if (method == CholMethod::Multifrontal)
+				initialize_multifrontal();
+		}
+
+		// The elimination tree, the dense trailing block, the supernodes and the column counts of L as stored
+		// by method, i.e. with the dense block and the supernodal padding. Only the pattern of A is used.
+		template <typename Tx2>
+		UniquePtr<Ti> stored_counts(const SparseMatrix<Tx2, Ti>& A)
+		{
+			Ti n = A.n;
+			this->parent = etree(A);
+			UniquePtr<Ti> post = postorder(this->parent.get(), n);
+			UniquePtr<Ti> cnt = colcounts(A, this->parent.get(), post.get());
+
+			initialize_dense(n, cnt.get());
+			if (method == CholMethod::Supernodal || method == CholMethod::Multifrontal)
+				initialize_supernodes(dense_start, cnt.get());
+			return cnt;
+		}
+
+		// Use the symbolic analysis of o without copying it and allocate the numeric arrays.
+		// o must be initialized and the pattern of the input must be the one o is initialized for.
+		// Tx = bool keeps only the symbolic analysis.
+		template <typename Tx2>
+		void share(const CholOutput<Tx2, Ti>& o)
+		{
+			pcs_assert(o.initialized(), "chol: share needs an initialized factor.");
+			Ti n = o.n;
+
+			this->m = o.m; this->n = n;
+			this->p = o.p; this->i = o.i;
+			method = o.method;
+			Lt.m = o.Lt.m; Lt.n = o.Lt.n; Lt.p = o.Lt.p; Lt.i = o.Lt.i;
+			diag = o.diag; parent = o.parent;
+			nblocks = o.nblocks; block_p = o.block_p;
+			dense_start = o.dense_start; dense_ratio = o.dense_ratio; dense_min = o.dense_min;
+			nsuper = o.nsuper; super = o.super;
+			update_p = o.update_p; update_k = o.update_k; update_s = o.update_s;
+			spost = o.spost; nchild = o.nchild; stack_size = o.stack_size;
+			task_threads = 0; // the tasks depend on the pool
+			solve_schedule = SolveSchedule<Ti>();
+
+			if (std::is_same<Tx, bool>::value) return;
 
-				// Solve L_11 l_12 = a_12
-				while (!q.empty())
+			this->x.reset(pcs_values_new<Tx>(this->nnz() > 0 ? this->nnz() : 1, scratch_dir));
+			c.reset(new Ti[n]);
+			w.reset(pcs_aligned_new<Tx>(n));
+			Hdiag.reset(pcs_aligned_new<Tx>(n));
+			E.reset(pcs_aligned_new<Tx>(n));
+			npert.reset(pcs_aligned_new<Tx>(1));
+			for (Ti k = 0; k < n; k++)
+				w[k] = Tx(0);
+			if (method == CholMethod::Supernodal || method == CholMethod::Multifrontal)
+				map.reset(new Ti[n]);
+			stack.reset(stack_size > 0 ? pcs_aligned_new<Tx>(stack_size) : nullptr);
+		}
+
+		// The symbolic analysis in the order of the file format (see serialize.h)
+		template <typename Archive>
+		void serialize(Archive& ar)
+		{
+			ar.scalar(this->m); ar.scalar(this->n); ar.scalar(method);
+			ar.scalar(dense_start); ar.scalar(dense_ratio); ar.scalar(dense_min);
+			ar.scalar(nsuper); ar.scalar(stack_size);
+			ar.scalar(Lt.m); ar.scalar(Lt.n); ar.scalar(nblocks);
+
+			size_t n = size_t(this->n), ns = size_t(nsuper);
+			ar.array(this->p, n + 1);
+			ar.array(this->i, this->p ? size_t(this->nnz()) : 0);
+			ar.array(Lt.p, size_t(Lt.n) + 1);
+			ar.array(Lt.i, Lt.p ? size_t(Lt.nnz()) : 0);
+			ar.array(diag, n);
+			ar.array(parent, n);
+			ar.array(block_p, size_t(nblocks) + 1);
+			ar.array(super, ns + 1);
+			ar.array(update_p, ns + 1);
+			ar.array(update_k, update_p ? size_t(update_p[ns]) : 0);
+			ar.array(update_s, update_p ? size_t(update_p[ns]) : 0);
+			ar.array(spost, ns);
+			ar.array(nchild, ns + 1);
+		}
+
+		// Groups of consecutive diagonal blocks with similar nnz(L) for the loops over the blocks on the pool
+		// The schedule of lsolve and ltsolve on the pool (see trisolve.h), null if there is no pool to run it.
+		// The factors sharing the pattern of L (e.g. PackedChol::Le) can use it too.
+		const SolveSchedule<Ti>* solve_tasks()
+		{
+			if (!pool || pool->size() <= 1 || !this->initialized())
+				return nullptr;
+			if (solve_schedule.pool != pool.get() || solve_schedule.nthreads != pool->size())
+				solve_schedule.initialize(*this, parent.get(), dense_start, pool.get(), nsuper, super);
+			return &solve_schedule;
+		}
+
+		BlockRanges<Ti> block_tasks() const
+		{
+			BlockRanges<Ti> r(this->n);
+			if (!pool || pool->size() <= 1 || nblocks <= 1)
+				return r;
+
+			Ti* Lp = this->p.get();
+			double limit = double(this->nnz()) / double(4 * pool->size());
+			r.pool = pool.get();
+			r.start.pop_back();
+			for (Ti b = 1; b < nblocks; b++)
+			{
+				if (double(Lp[block_p[b]] - Lp[r.start.back()]) >= limit)
+					r.start.push_back(block_p[b]);
+			}
+			r.start.push_back(this->n);
+			return r;
+		}
+
+		// Find the smallest t such that L(t:n, t:n) has at least dense_ratio of its entries nonzero
+		// and pad the column counts of the columns t, ..., n-1 to dense.
+		void initialize_dense(Ti n, Ti* cnt)
+		{
+			dense_start = n;
+			double nz = 0.0;
+			for (Ti t = n - 1; t >= 0; t--)
+			{
+				nz += double(cnt[t]);
+				double size = double(n - t);
+				if (n - t >= dense_min && nz >= dense_ratio * size * (size + 1.0) / 2.0)
+					dense_start = t;
+			}
+
+			for (Ti j = dense_start; j < n; j++)
+				cnt[j] = n - j;
+		}
+
+		// Partition the columns into relaxed supernodes and update cnt to the padded column counts.
+		// Column j+1 joins the supernode of column j if it is the parent of j in the elimination tree
+		// and the number of explicit zeros added is small.
+		void initialize_supernodes(Ti n, Ti* cnt)
+		{
+			std::vector<Ti> s_start;
+
+			Ti f = 0;			// first column of the current supernode
+			Ti nz_orig = 0;		// number of nonzeros of the current supernode before padding
+			for (Ti j = 0; j < n; j++)
+			{
+				nz_orig += cnt[j];
+				if (j == f) s_start.push_back(f);
+
+				// try to merge j+1 into [f, j]
+				bool merge = false;
+				if (j + 1 < n && parent[j] == j + 1)
 				{
-					Ti j = q.top();
+					Ti ns = j + 2 - f;
+					double nz_new = double(ns) * double(ns - 1) / 2.0 + double(ns) * double(cnt[j + 1]);
+					double zeros = nz_new - double(nz_orig + cnt[j + 1]);
+					double frac = zeros / nz_new;
 
-					for (Ti k : cols[j])
+					// the relaxation rule of CHOLMOD
+					merge = (zeros == 0.0) || (ns <= 4) || (ns <= 16 && frac < 0.8) || (ns <= 48 && frac < 0.1) || (frac < 0.05);
+				}
+
+				if (!merge)
+				{	// pad the columns f, ..., j-1 to the pattern of the column j
+					for (Ti k = f; k < j; k++)
+						cnt[k] = (j - k) + cnt[j];
+					f = j + 1; nz_orig = 0;
+				}
+			}
+
+			nsuper = Ti(s_start.size());
+			super.reset(new Ti[nsuper + 1]);
+			std::copy(s_start.begin(), s_start.end(), super.get());
+			super[nsuper] = n;
+		}
+
+		// For each supernode J, find all supernodes K with L(J, K) != 0 and the rows involved.
+		void initialize_updates()
+		{
+			Ti n = this->n, * Lp = this->p.get(), * Li = this->i.get();
+			Ti* col_to_super = new Ti[n];
+			for (Ti s = 0; s < nsuper; s++)
+				for (Ti j = super[s]; j < super[s + 1]; j++)
+					col_to_super[j] = s;
+
+			// count the updates for each supernode, then fill it
+			update_p.reset(new Ti[nsuper + 1]());
+			for (int pass = 0; pass < 2; pass++)
+			{
+				for (Ti k = 0; k < nsuper; k++)
+				{
+					Ti f = super[k], ns = super[k + 1] - f;
+					Ti* R = Li + Lp[f], nr = Lp[f + 1] - Lp[f];
+					Ti last = -1;
+					for (Ti r = ns; r < nr && R[r] < dense_start; r++)
 					{
-						if (mark[k] != i)
+						Ti J = col_to_super[R[r]];
+						if (J == last) continue;
+						last = J;
+
+						if (pass == 0)
+							update_p[J + 1]++;
+						else
 						{
-							q.push(k);
-							mark[k] = i;
+							Ti q = update_p[J]++;
+							update_k[q] = k;
+							update_s[q] = r;
 						}
 					}
-					q.pop();
+				}
 
-					// update j col
-					cols[j].push_back(i);
-					++nz;
+				if (pass == 0)
+				{
+					for (Ti s = 0; s < nsuper; s++)
+						update_p[s + 1] += update_p[s];
+					update_k.reset(new Ti[update_p[nsuper] + 1]);
+					update_s.reset(new Ti[update_p[nsuper] + 1]);
+				}
+				else
+				{	// update_p[s] was shifted to update_p[s+1] by the fill
+					for (Ti s = nsuper; s > 0; s--)
+						update_p[s] = update_p[s - 1];
+					update_p[0] = 0;
 				}
+			}
+			delete[] col_to_super;
+
+			map.reset(new Ti[n]);
+		}
 
-				// diag
-				cols[i].push_back(i);
-				++nz;
+		// The update matrix of the supernode J is the lower triangular part of a dense (nr-ns) x (nr-ns) matrix
+		// without the part inside the dense trailing block, which is updated by chol_dense instead.
+		// Compute the postorder of the supernodal tree and the peak size of the update matrix stack.
+		void initialize_multifrontal()
+		{
+			Ti n = this->n, * Lp = this->p.get();
+
+			Ti* col_to_super = new Ti[n];
+			for (Ti s = 0; s < nsuper; s++)
+				for (Ti j = super[s]; j < super[s + 1]; j++)
+					col_to_super[j] = s;
+
+			UniquePtr<Ti> sparent(new Ti[size_t(nsuper) + 1]);
+			nchild.reset(new Ti[size_t(nsuper) + 1]());
+			for (Ti J = 0; J < nsuper; J++)
+			{
+				Ti p = parent[super[J + 1] - 1];
+				sparent[J] = (p == -1 || p >= dense_start) ? -1 : col_to_super[p];
+				if (sparent[J] != -1) nchild[sparent[J]]++;
 			}
-			delete[] mark;
+			delete[] col_to_super;
+			spost = postorder(sparent.get(), nsuper);
 
-			// write it as the compress form
-			SparseMatrix<Tx, Ti>::initialize(n, n, nz);
+			// simulate the stack
+			std::vector<size_t> sizes;
+			size_t top = 0, peak = 1;
+			for (Ti k = 0; k < nsuper; k++)
+			{
+				Ti J = spost[k], f = super[J];
+				size_t m = size_t(Lp[f + 1] - Lp[f]) - size_t(super[J + 1] - f), mc = size_t(update_cols(J));
+				size_t size = mc * m - mc * (mc - 1) / 2;
+				peak = std::max(peak, top + size);
+				for (Ti c = 0; c < nchild[J]; c++)
+				{
+					top -= sizes.back();
+					sizes.pop_back();
+				}
+				sizes.push_back(size);
+				top += size;
+			}
 
-			Ti s_start = 0; Ti s = 0;
-			for (Ti i = 0; i < n; i++)
+			stack_size = peak;
+			stack.reset(pcs_aligned_new<Tx>(peak));
+			map.reset(new Ti[n]);
+		}
+
+		// The number of columns of the update matrix of the supernode J, i.e. the number of its rows
+		// below its columns and before the dense trailing block
+		Ti update_cols(Ti J) const
+		{
+			Ti f = super[J], ns = super[J + 1] - f;
+			Ti* R = this->i.get() + this->p[f], nr = this->p[f + 1] - this->p[f];
+			return Ti(std::lower_bound(R + ns, R + nr, dense_start) - R) - ns;
+		}
+
+		// Split the supernodal elimination tree into independent subtrees for the threads.
+		// We repeatedly move the root of the most expensive subtree to the top part until
+		// every subtree costs at most 1/(2 nthreads) of the total.
+		void initialize_tasks()
+		{
+			Ti n = this->n, * Lp = this->p.get();
+			size_t nthreads = pool->size();
+
+			Ti* col_to_super = new Ti[n];
+			for (Ti s = 0; s < nsuper; s++)
+				for (Ti j = super[s]; j < super[s + 1]; j++)
+					col_to_super[j] = s;
+
+			// the supernodal tree and the cost of each subtree
+			std::vector<Ti> sparent(nsuper), head(nsuper, -1), next(nsuper, -1), owner(nsuper);
+			std::vector<double> cost(nsuper, 0.0);
+			double total = 0.0;
+			for (Ti J = 0; J < nsuper; J++)
 			{
-				this->p[i] = s_start;
-				for (Ti k : cols[i])
-					this->i[s++] = k;
-				s_start += Ti(cols[i].size());
+				Ti p = parent[super[J + 1] - 1];
+				sparent[J] = (p == -1 || p >= dense_start) ? -1 : col_to_super[p];
+				for (Ti j = super[J]; j < super[J + 1]; j++)
+				{
+					double cnt = double(Lp[j + 1] - Lp[j]);
+					cost[J] += cnt * cnt;
+				}
+				total += cost[J];
+			}
+			for (Ti J = 0; J < nsuper; J++)
+			{
+				if (sparent[J] == -1) continue;
+				cost[sparent[J]] += cost[J];
 			}
-			this->p[n] = s_start;
-			delete[] cols;
+			for (Ti J = nsuper - 1; J >= 0; J--)
+			{
+				if (sparent[J] == -1) continue;
+				next[J] = head[sparent[J]];
+				head[sparent[J]] = J;
+			}
+			delete[] col_to_super;
 
-			this->Lt = transpose<Tx, Ti, bool>(*this);
+			// split the most expensive subtree
+			using Item = std::pair<double, Ti>;
+			std::priority_queue<Item> heap;
+			std::vector<bool> is_top(nsuper, false);
+			for (Ti J = 0; J < nsuper; J++)
+				if (sparent[J] == -1) heap.push(Item(cost[J], J));
 
-			// initialize w to 0
-			Tx Tv0 = Tx(0);
-			for (Ti k = 0; k < n; k++)
-				w[k] = Tv0;
+			double limit = total / double(2 * nthreads);
+			while (!heap.empty() && heap.top().first > limit)
+			{
+				Ti J = heap.top().second;
+				heap.pop();
+				is_top[J] = true;
+				for (Ti K = head[J]; K != -1; K = next[K])
+					heap.push(Item(cost[K], K));
+			}
+
+			// the subtrees are listed from the most expensive one
+			ntasks = Ti(heap.size());
+			std::vector<Ti> root_task(nsuper, -1);
+			for (Ti t = 0; t < ntasks; t++)
+			{
+				root_task[heap.top().second] = t;
+				heap.pop();
+			}
+
+			for (Ti J = nsuper - 1; J >= 0; J--)
+			{
+				if (is_top[J])
+					owner[J] = ntasks;
+				else if (root_task[J] != -1)
+					owner[J] = root_task[J];
+				else
+					owner[J] = owner[sparent[J]];
+			}
+
+			task_p.reset(new Ti[size_t(ntasks) + 2]());
+			task_s.reset(new Ti[size_t(nsuper) + 1]);
+			for (Ti J = 0; J < nsuper; J++)
+				task_p[owner[J] + 1]++;
+			for (Ti t = 0; t <= ntasks; t++)
+				task_p[t + 1] += task_p[t];
+			std::vector<Ti> c(task_p.get(), task_p.get() + ntasks + 1);
+			for (Ti J = 0; J < nsuper; J++)
+				task_s[c[owner[J]]++] = J;
+
+			w_thread.reset(pcs_aligned_new<Tx>(size_t(n) * nthreads));
+			map_thread.reset(new Ti[size_t(n) * nthreads]);
+			npert_thread.reset(pcs_aligned_new<Tx>(nthreads));
+			task_threads = nthreads;
+		}
+	};
+
+	// The triangular solves with a factor use its supernodes if it has any (see lsolve_supernodal)
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve(const CholOutput<Tx, Ti>& L, Tx2* x, Tx2* out, Ti j0, Ti j1)
+	{
+		if (L.nsuper > 0)
+			lsolve_supernodal(L, L.nsuper, L.super.get(), x, out, j0, j1);
+		else
+			lsolve(static_cast<const SparseMatrix<Tx, Ti>&>(L), x, out, j0, j1, L.dense_start);
+	}
+
+	template <typename Tx, typename Ti, typename Tx2>
+	void ltsolve(const CholOutput<Tx, Ti>& L, Tx2* x, Tx2* out, Ti j0, Ti j1)
+	{
+		if (L.nsuper > 0)
+			ltsolve_supernodal(L, L.nsuper, L.super.get(), x, out, j0, j1);
+		else
+			ltsolve(static_cast<const SparseMatrix<Tx, Ti>&>(L), x, out, j0, j1, L.dense_start);
+	}
+
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve(const CholOutput<Tx, Ti>& L, Tx2* x, Tx2* out = nullptr)
+	{
+		lsolve(L, x, out ? out : x, Ti(0), L.n);
+	}
+
+	template <typename Tx, typename Ti, typename Tx2>
+	void ltsolve(const CholOutput<Tx, Ti>& L, Tx2* x, Tx2* out = nullptr)
+	{
+		ltsolve(L, x, out ? out : x, Ti(0), L.n);
+	}
+
+	// The cost of chol(H) predicted from the column counts of L (see chol_analyze). The flops count
+	// a multiply-add as 2 and are per lane.
+	struct CholAnalysis
+	{
+		double nnzH = 0.0;			// nonzeros of H (both triangles)
+		double nnzL = 0.0;			// nonzeros of L as stored, with the supernodal padding and the dense trailing block
+		double flopsChol = 0.0;		// sum_j nnz(L(:, j))^2
+		double flopsProjinv = 0.0;	// 2 sum_j nnz(L(:, j))^2, each entry of row k of L reads its whole column
+		double flopsSolve = 0.0;	// lsolve and ltsolve, 4 nnz(L)
+	};
+
+	// Predict the size of L and the cost of chol, projinv and the solves without building L.
+	// The kernel and the dense block parameters are the ones of L (CholMethod::Auto counts as supernodal).
+	template <typename Tx, typename Ti, typename Tx2>
+	CholAnalysis chol_analyze(const SparseMatrix<Tx, Ti>& H, const CholOutput<Tx2, Ti>& L)
+	{
+		pcs_assert(H.initialized(), "chol_analyze: bad inputs.");
+		pcs_assert(H.n == H.m, "chol_analyze: dimensions mismatch.");
+
+		CholOutput<bool, Ti> S;
+		S.method = (L.method == CholMethod::Auto) ? CholMethod::Supernodal : L.method;
+		S.dense_ratio = L.dense_ratio;
+		S.dense_min = L.dense_min;
+		UniquePtr<Ti> cnt = S.stored_counts(H);
+
+		CholAnalysis r;
+		r.nnzH = double(H.nnz());
+		for (Ti j = 0; j < H.n; j++)
+		{
+			double c = double(cnt[j]);
+			r.nnzL += c;
+			r.flopsChol += c * c;
+		}
+		r.flopsProjinv = 2.0 * r.flopsChol;
+		r.flopsSolve = 4.0 * r.nnzL;
+		return r;
+	}
+
+	// H is stored as a sparse matrix with a symmetric pattern. diag[j] is the first entry of H(j:n, j).
+	template <typename Tx, typename Ti>
+	struct StoredColumns
+	{
+		const SparseMatrix<Tx, Ti>& H;
+		const Ti* diag;
+
+		// f(i) += H(i, j) for i >= j
+		template <typename F>
+		void lower(Ti j, F f) const
+		{
+			Ti* Hp = H.p.get(), * Hi = H.i.get(); Tx* Hx = H.x.get();
+			for (Ti s = diag[j]; s < Hp[j + 1]; ++s)
+				f(Hi[s]) += Hx[s];
+		}
+
+		// f(i) += H(i, j) for i <= j
+		template <typename F>
+		void upper(Ti j, F f) const
+		{
+			Ti* Hp = H.p.get(), * Hi = H.i.get(); Tx* Hx = H.x.get();
+			Ti s_end = diag[j];
+			if (s_end < Hp[j + 1] && Hi[s_end] == j) ++s_end;
+			for (Ti s = Hp[j]; s < s_end; ++s)
+				f(Hi[s]) += Hx[s];
+		}
+	};
+
+	// H is stored as its lower triangle (see MultiplyOutput::lower)
+	template <typename Tx, typename Ti>
+	struct LowerColumns
+	{
+		const MultiplyOutput<Tx, Ti>& H;
+
+		// f(i) += H(i, j) for i >= j
+		template <typename F>
+		void lower(Ti j, F f) const
+		{
+			Ti* Hp = H.p.get(), * Hi = H.i.get(); Tx* Hx = H.x.get();
+			for (Ti s = Hp[j]; s < Hp[j + 1]; ++s)
+				f(Hi[s]) += Hx[s];
+		}
+
+		// f(i) += H(i, j) = H(j, i) for i <= j
+		template <typename F>
+		void upper(Ti j, F f) const
+		{
+			Ti* Up = H.upper.p.get(), * Ui = H.upper.i.get(), * Us = H.upper_s.get(); Tx* Hx = H.x.get();
+			for (Ti q = Up[j]; q < Up[j + 1]; ++q)
+				f(Ui[q]) += Hx[Us[q]];
+		}
+	};
+
+	// H = A diag(w) A' where At = A'
+	template <typename Tx, typename Ti, typename Tx2>
+	struct FusedColumns
+	{
+		const SparseMatrix<Tx2, Ti>& A;
+		const SparseMatrix<Tx2, Ti>& At;
+		const Tx* w;
+
+		// f(i) += H(i, j) for i >= j
+		template <typename F>
+		void lower(Ti j, F f) const
+		{
+			Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx2* Ax = A.x.get();
+			Ti* Atp = At.p.get(), * Ati = At.i.get(); Tx2* Atx = At.x.get();
+			for (Ti p = Atp[j]; p < Atp[j + 1]; ++p)
+			{
+				Ti t = Ati[p];
+				Tx beta = Tx(Atx[p]) * w[t];
+				Ti q_end = Ap[t + 1];
+				for (Ti q = Ti(std::lower_bound(Ai + Ap[t], Ai + q_end, j) - Ai); q < q_end; ++q)
+					fmadd(f(Ai[q]), beta, Ax[q]);
+			}
+		}
+
+		// f(i) += H(i, j) for i <= j
+		template <typename F>
+		void upper(Ti j, F f) const
+		{
+			Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx2* Ax = A.x.get();
+			Ti* Atp = At.p.get(), * Ati = At.i.get(); Tx2* Atx = At.x.get();
+			for (Ti p = Atp[j]; p < Atp[j + 1]; ++p)
+			{
+				Ti t = Ati[p];
+				Tx beta = Tx(Atx[p]) * w[t];
+				for (Ti q = Ap[t]; q < Ap[t + 1] && Ai[q] <= j; ++q)
+					fmadd(f(Ai[q]), beta, Ax[q]);
+			}
 		}
 	};
 
+	// L_jj = sqrt(d) with static pivoting, see CholOutput::pivot_tol
+	template <typename Tx, typename Ti>
+	Tx chol_pivot(CholOutput<Tx, Ti>& o, Ti j, const Tx& d, Tx& npert)
+	{
+		Tx npert_old = npert;
+		Tx Ljj = pivot_sqrt(d, o.Hdiag[j], o.pivot_tol, 1e128, npert);
+		o.E[j] = (Ljj * Ljj - d) * (npert - npert_old); // npert - npert_old is 1 for the replaced pivots and 0 otherwise
+		return Ljj;
+	}
+
+	template <typename Tx, typename Ti, typename Source>
+	void chol_numeric(CholOutput<Tx, Ti>& o, const Source& H)
+	{
+		o.npert[0] = Tx(0.0);
+		if (o.method == CholMethod::Supernodal)
+			chol_supernodal(o, H);
+		else if (o.method == CholMethod::Multifrontal || o.method == CholMethod::UpLooking || o.method == CholMethod::LeftLooking)
+			chol_blocks(o, H);
+		else
+			pcs_assert(false, "chol: unknown method.");
+
+		if (o.dense_start < o.n)
+			chol_dense(o, H);
+	}
+
 	template <typename Tx, typename Ti>
 	void chol(CholOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& A)
 	{
 		if (!o.initialized())
 			o.initialize(A);
 
-		//chol_up_looking(o, A);
-		chol_left_looking(o, A);
+		chol_numeric(o, StoredColumns<Tx, Ti>{ A, o.diag.get() });
 	}
 
 	template <typename Tx, typename Ti>
-	void chol_up_looking(CholOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& A)
+	void chol(CholOutput<Tx, Ti>& o, const MultiplyOutput<Tx, Ti>& H)
+	{
+		if (!H.lower)
+		{
+			chol(o, static_cast<const SparseMatrix<Tx, Ti>&>(H));
+			return;
+		}
+
+		if (!o.initialized())
+			o.initialize(H.symmetric_pattern());
+
+		chol_numeric(o, LowerColumns<Tx, Ti>{ H });
+	}
+
+	// Compute chol(A diag(w) A') without forming A diag(w) A'
+	template <typename Tx, typename Ti, typename Tx2>
+	void chol(CholOutput<Tx, Ti>& o, const SparseMatrix<Tx2, Ti>& A, const Tx* w, const SparseMatrix<Tx2, Ti>& At)
+	{
+		if (!o.initialized())
+		{
+			MultiplyOutput<bool, Ti> H; // pattern only
+			H.initialize(A, At);
+			o.initialize(H);
+		}
+
+		chol_numeric(o, FusedColumns<Tx, Ti, Tx2>{ A, At, w });
+	}
+
+	// Factor the diagonal blocks of L in the ranges of o.block_tasks(). The blocks touch disjoint entries
+	// of w, c and map, so only npert and the stack of chol_multifrontal are per thread.
+	template <typename Tx, typename Ti, typename Source>
+	void chol_blocks(CholOutput<Tx, Ti>& o, const Source& A)
+	{
+		BlockRanges<Ti> ranges = o.block_tasks();
+		auto factor = [&o, &A](Ti j0, Ti j1, Tx* stack, Tx& npert) {
+			if (o.method == CholMethod::Multifrontal)
+			{
+				Ti* super = o.super.get();
+				Ti S0 = Ti(std::lower_bound(super, super + o.nsuper, j0) - super);
+				Ti S1 = Ti(std::lower_bound(super, super + o.nsuper, j1) - super);
+				chol_multifrontal(o, A, S0, S1, stack, npert);
+			}
+			else if (o.method == CholMethod::UpLooking)
+				chol_up_looking(o, A, j0, j1, npert);
+			else
+				chol_left_looking(o, A, j0, j1, npert);
+		};
+
+		if (!ranges.pool)
+		{
+			factor(0, o.n, o.stack.get(), o.npert[0]);
+			return;
+		}
+
+		size_t nthreads = ranges.pool->size();
+		if (o.task_threads != nthreads)
+		{
+			o.npert_thread.reset(pcs_aligned_new<Tx>(nthreads));
+			o.stack_thread.reset(o.method == CholMethod::Multifrontal ? pcs_aligned_new<Tx>(o.stack_size * nthreads) : nullptr);
+			o.task_threads = nthreads;
+		}
+
+		for (size_t tid = 0; tid < nthreads; ++tid)
+			o.npert_thread[tid] = Tx(0.0);
+		ranges.run([&o, &factor](Ti j0, Ti j1, size_t tid) {
+			Tx* stack = o.stack_thread ? o.stack_thread.get() + tid * o.stack_size : nullptr;
+			factor(j0, j1, stack, o.npert_thread[tid]);
+		});
+		for (size_t tid = 0; tid < nthreads; ++tid)
+			o.npert[0] += o.npert_thread[tid];
+	}
+
+	// Compute the rows k0, ..., k1-1 of L, which must be a union of diagonal blocks
+	template <typename Tx, typename Ti, typename Source>
+	void chol_up_looking(CholOutput<Tx, Ti>& o, const Source& A, Ti k0, Ti k1, Tx& npert)
 	{
-		Ti *Ap = A.p.get(), * Ai = A.i.get(); Tx* Ax = A.x.get();
-		Ti nzmax = o.nzmax; Ti n = A.n;
 		Ti *Lp = o.p.get(); Ti* Li = o.i.get();
-		Ti *Ltp = o.Lt.p.get(); Ti* Lti = o.Lt.i.get();
+		Ti* Ltp = o.Lt.p.get(), * Lti = o.Lt.i.get();
 
 		Tx T0 = Tx(0);
 		Tx* Lx = o.x.get(); Tx* w = o.w.get(); Ti* c = o.c.get();
-		Ti* diag = o.diag.get();
 
-		Ti* Lti_ptr = Lti;
-		for (Ti k = 0; k < n; ++k)
+		// the rows in the dense trailing block only compute their part left to the block
+		Ti ds = o.dense_start;
+		Ti* Lti_ptr = Lti + Ltp[k0];
+		for (Ti k = k0; k < k1; ++k)
 		{
-			c[k] = Lp[k];
+			if (k < ds) c[k] = Lp[k];
 
-			Ti s_end = diag[k];
-			for (Ti s = Ap[k]; s < s_end; ++s)
-				w[Ai[s]] = Ax[s];
+			// x = A_{1:k, k}
+			A.upper(k, [w](Ti i) -> Tx& { return w[i]; });
 
 			// Solve L_11 l_12 = a_12
-			Tx d = Ax[s_end]; Ti i;
-			for (; (i = *(Lti_ptr++)) < k;)
+			Tx d = w[k]; Ti i, i_end = std::min(k, ds);
+			o.Hdiag[k] = d;
+			w[k] = T0;
+			for (; (i = *Lti_ptr) < i_end; ++Lti_ptr)
 			{
 				Ti dLi = Lp[i], ci = c[i]++;
 				Tx Lki = w[i] / Lx[dLi];
@@ -164,34 +954,39 @@ namespace PackedCSparse {
 				Lx[ci] = Lki;
 			}
 
+			if (k >= ds)
+			{
+				Lti_ptr += k - ds + 1;
+				for (Ti j = ds; j < k; ++j)
+					w[j] = T0;
+				continue;
+			}
+
 			// l_22 = sqrt(a22 - <l12,l12>)
-			Lx[c[k]++] = clipped_sqrt(d);
+			++Lti_ptr;
+			Lx[c[k]++] = chol_pivot(o, k, d, npert);
 		}
 	}
 
-	template <typename Tx, typename Ti>
-	void chol_left_looking(CholOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& A)
+	// Compute the columns j0, ..., j1-1 of L, which must be a union of diagonal blocks
+	template <typename Tx, typename Ti, typename Source>
+	void chol_left_looking(CholOutput<Tx, Ti>& o, const Source& A, Ti j0, Ti j1, Tx& npert)
 	{
-		Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx* Ax = A.x.get();
-		Ti nzmax = o.nnz(); Ti n = A.n;
 		Ti* Lp = o.p.get(); Ti* Li = o.i.get();
 		Ti* Ltp = o.Lt.p.get(); Ti* Lti = o.Lt.i.get();
 
 		Tx T0 = Tx(0), T1 = Tx(1);
 		Tx* Lx = o.x.get();
 		Tx* w = o.w.get(); Ti* c = o.c.get();
-		Ti* diag = o.diag.get();
 
-		for (Ti j = 0; j < n; ++j)
+		Ti j_end = std::min(j1, o.dense_start);
+		for (Ti j = j0; j < j_end; ++j)
 		{
 			c[j] = Lp[j];
 
 			// x = A_{j:n, j}
-			{
-				Ti is_start = diag[j], is_end = Ap[j + 1];
-				for (Ti is = is_start; is < is_end; ++is)
-					w[Ai[is]] = Ax[is];
-			}
+			A.lower(j, [w](Ti i) -> Tx& { return w[i]; });
+			o.Hdiag[j] = w[j];
 
 			// for each p in L_{j, 1:j-1}
 			Ti ps_start = Ltp[j], ps_end = Ltp[j + 1] - 1;
@@ -210,7 +1005,7 @@ namespace PackedCSparse {
 				}
 			}
 
-			Tx Ljj = clipped_sqrt(w[j], 1e128);
+			Tx Ljj = chol_pivot(o, j, w[j], npert);
 			Lx[c[j]++] = Ljj;
 			Tx inv_Ljj = T1 / Ljj;
 			w[j] = T0;
@@ -228,6 +1023,467 @@ namespace PackedCSparse {
 		}
 	}
 
+	// Compute the supernode J of L. It reads only the descendants of J and writes only J.
+	template <typename Tx, typename Ti, typename Source>
+	void chol_supernode(CholOutput<Tx, Ti>& o, const Source& A, Ti J, Tx* w, Ti* map, Tx& npert)
+	{
+		Ti* Lp = o.p.get(); Ti* Li = o.i.get();
+
+		Tx T0 = Tx(0), T1 = Tx(1);
+		Tx* Lx = o.x.get(), * Hdiag = o.Hdiag.get();
+		Ti* super = o.super.get();
+		Ti* update_p = o.update_p.get(), * update_k = o.update_k.get(), * update_s = o.update_s.get();
+
+		// the supernode J is the columns f...l-1 with rows R[0...nr-1]
+		// the entries of the column j = f + jj are Lx[Lp[j] + r - jj] for r >= jj
+		Ti f = super[J], l = super[J + 1], ns = l - f;
+		Ti* R = Li + Lp[f], nr = Lp[f + 1] - Lp[f];
+
+		for (Ti r = 0; r < nr; ++r)
+			map[R[r]] = r;
+
+		// L_J = A_{:,J}
+		for (Ti jj = 0; jj < ns; ++jj)
+		{
+			Ti j = f + jj;
+			Tx* Lj = Lx + Lp[j] - jj;
+			for (Ti r = jj; r < nr; ++r)
+				Lj[r] = T0;
+
+			A.lower(j, [Lj, map](Ti i) -> Tx& { return Lj[map[i]]; });
+			Hdiag[j] = Lj[jj];
+		}
+
+		// for each supernode K with L(J, K) != 0
+		for (Ti q = update_p[J]; q < update_p[J + 1]; ++q)
+		{
+			Ti K = update_k[q], fK = super[K], nsK = super[K + 1] - fK;
+			Ti* RK = Li + Lp[fK], nrK = Lp[fK + 1] - Lp[fK];
+			Ti s_start = update_s[q], s_end = s_start;
+			while (s_end < nrK && RK[s_end] < l) ++s_end;
+
+			// for each column j of J in the pattern of K
+			for (Ti s = s_start; s < s_end; ++s)
+			{
+				// w = L_{s:nrK, K} L_{s, K}'
+				Ti len = nrK - s;
+				for (Ti r = 0; r < len; ++r)
+					w[r] = T0;
+
+				for (Ti t = 0; t < nsK; ++t)
+				{
+					Tx* LK = Lx + Lp[fK + t] - t + s;
+					Tx Ljt = LK[0];
+					for (Ti r = 0; r < len; ++r)
+						fmadd(w[r], LK[r], Ljt);
+				}
+
+				// L_{:,j} -= w
+				Ti j = RK[s];
+				Tx* Lj = Lx + Lp[j] - (j - f);
+				Ti* RKs = RK + s;
+				for (Ti r = 0; r < len; ++r)
+				{
+					Lj[map[RKs[r]]] -= w[r];
+					w[r] = T0;
+				}
+			}
+		}
+
+		// dense left-looking cholesky on the supernode
+		for (Ti jj = 0; jj < ns; ++jj)
+		{
+			Tx* Lj = Lx + Lp[f + jj] - jj;
+			for (Ti tt = 0; tt < jj; ++tt)
+			{
+				Tx* Lk = Lx + Lp[f + tt] - tt;
+				Tx Ljk = Lk[jj];
+				for (Ti r = jj; r < nr; ++r)
+					fnmadd(Lj[r], Lk[r], Ljk);
+			}
+
+			Tx Ljj = chol_pivot(o, f + jj, Lj[jj], npert);
+			Lj[jj] = Ljj;
+			Tx inv_Ljj = T1 / Ljj;
+			for (Ti r = jj + 1; r < nr; ++r)
+				Lj[r] *= inv_Ljj;
+		}
+	}
+
+	template <typename Tx, typename Ti, typename Source>
+	void chol_supernodal(CholOutput<Tx, Ti>& o, const Source& A)
+	{
+		if (!o.pool || o.pool->size() <= 1)
+		{
+			for (Ti J = 0; J < o.nsuper; ++J)
+				chol_supernode(o, A, J, o.w.get(), o.map.get(), o.npert[0]);
+			return;
+		}
+
+		if (o.task_threads != o.pool->size())
+			o.initialize_tasks();
+
+		Ti n = o.n, * task_p = o.task_p.get(), * task_s = o.task_s.get();
+		for (size_t tid = 0; tid < o.task_threads; ++tid)
+			o.npert_thread[tid] = Tx(0.0);
+
+		std::vector<ThreadPool::Task> tasks;
+		for (Ti t = 0; t < o.ntasks; ++t)
+		{
+			tasks.push_back([&o, &A, n, task_p, task_s, t](size_t tid) {
+				Tx* w = o.w_thread.get() + tid * n;
+				Ti* map = o.map_thread.get() + tid * n;
+				for (Ti q = task_p[t]; q < task_p[t + 1]; ++q)
+					chol_supernode(o, A, task_s[q], w, map, o.npert_thread[tid]);
+			});
+		}
+		o.pool->run(tasks);
+
+		for (size_t tid = 0; tid < o.task_threads; ++tid)
+			o.npert[0] += o.npert_thread[tid];
+		for (Ti q = task_p[o.ntasks]; q < task_p[o.ntasks + 1]; ++q)
+			chol_supernode(o, A, task_s[q], o.w.get(), o.map.get(), o.npert[0]);
+	}
+
+	// Compute the supernodes spost[S0], ..., spost[S1-1], which must be the supernodes of a union of
+	// diagonal blocks. stack has o.stack_size entries.
+	template <typename Tx, typename Ti, typename Source>
+	void chol_multifrontal(CholOutput<Tx, Ti>& o, const Source& A, Ti S0, Ti S1, Tx* stack, Tx& npert)
+	{
+		Ti* Lp = o.p.get(); Ti* Li = o.i.get();
+
+		Tx T0 = Tx(0), T1 = Tx(1);
+		Tx* Lx = o.x.get(), * Hdiag = o.Hdiag.get();
+		Ti* map = o.map.get(), * super = o.super.get();
+		Ti* spost = o.spost.get(), * nchild = o.nchild.get();
+
+		// the update matrix U of the supernode K is the lower triangular part of a dense m x m matrix
+		// with rows RK[nsK...nrK-1] and U(a, b) = U[b * m - b * (b - 1) / 2 + a - b] for a >= b
+		// Only the first mc = update_cols(K) columns are stored, the rest is in the dense trailing block.
+		std::vector<std::pair<Tx*, Ti>> frames; // (U, K) on the stack
+		Tx* top = stack;
+
+		for (Ti k = S0; k < S1; ++k)
+		{
+			// the supernode J is the columns f...l-1 with rows R[0...nr-1]
+			Ti J = spost[k];
+			Ti f = super[J], l = super[J + 1], ns = l - f;
+			Ti* R = Li + Lp[f], nr = Lp[f + 1] - Lp[f], m = nr - ns, mc = o.update_cols(J);
+
+			for (Ti r = 0; r < nr; ++r)
+				map[R[r]] = r;
+
+			// L_J = A_{:,J}
+			for (Ti jj = 0; jj < ns; ++jj)
+			{
+				Ti j = f + jj;
+				Tx* Lj = Lx + Lp[j] - jj;
+				for (Ti r = jj; r < nr; ++r)
+					Lj[r] = T0;
+
+				A.lower(j, [Lj, map](Ti i) -> Tx& { return Lj[map[i]]; });
+				Hdiag[j] = Lj[jj];
+			}
+
+			// the update matrices of the children are on the top of the stack and U goes above them
+			Tx* U = top;
+			size_t Usize = size_t(mc) * m - size_t(mc) * (mc - 1) / 2;
+			for (size_t s = 0; s < Usize; ++s)
+				U[s] = T0;
+
+			// extend-add the update matrices of the children
+			Tx* bottom = top;
+			for (Ti c = 0; c < nchild[J]; ++c)
+			{
+				Tx* UK = frames.back().first; Ti K = frames.back().second;
+				frames.pop_back();
+				bottom = UK;
+
+				Ti fK = super[K], nsK = super[K + 1] - fK;
+				Ti* RK = Li + Lp[fK] + nsK, mK = Lp[fK + 1] - Lp[fK] - nsK, mcK = o.update_cols(K);
+				for (Ti b = 0; b < mcK; ++b)
+				{
+					Tx* UKb = UK + (size_t(b) * mK - size_t(b) * (b - 1) / 2) - b;
+					Ti rb = map[RK[b]];
+					if (rb < ns)
+					{	// column of the supernode
+						Tx* Lj = Lx + Lp[f + rb] - rb;
+						for (Ti a = b; a < mK; ++a)
+							Lj[map[RK[a]]] += UKb[a];
+					}
+					else
+					{	// column of U
+						Ti cb = rb - ns;
+						Tx* Uc = U + (size_t(cb) * m - size_t(cb) * (cb - 1) / 2) - cb;
+						for (Ti a = b; a < mK; ++a)
+							Uc[map[RK[a]] - ns] += UKb[a];
+					}
+				}
+			}
+
+			// dense left-looking cholesky on the supernode
+			for (Ti jj = 0; jj < ns; ++jj)
+			{
+				Tx* Lj = Lx + Lp[f + jj] - jj;
+				for (Ti tt = 0; tt < jj; ++tt)
+				{
+					Tx* Lk = Lx + Lp[f + tt] - tt;
+					Tx Ljk = Lk[jj];
+					for (Ti r = jj; r < nr; ++r)
+						fnmadd(Lj[r], Lk[r], Ljk);
+				}
+
+				Tx Ljj = chol_pivot(o, f + jj, Lj[jj], npert);
+				Lj[jj] = Ljj;
+				Tx inv_Ljj = T1 / Ljj;
+				for (Ti r = jj + 1; r < nr; ++r)
+					Lj[r] *= inv_Ljj;
+			}
+
+			// U -= L_{ns:nr, J} L_{ns:nr, J}'
+			for (Ti tt = 0; tt < ns; ++tt)
+			{
+				Tx* Lk = Lx + Lp[f + tt] - tt + ns;
+				for (Ti b = 0; b < mc; ++b)
+				{
+					Tx* Ub = U + (size_t(b) * m - size_t(b) * (b - 1) / 2) - b;
+					Tx Lbk = Lk[b];
+					for (Ti a = b; a < m; ++a)
+						fnmadd(Ub[a], Lk[a], Lbk);
+				}
+			}
+
+			// pop the children and push U
+			if (bottom != U)
+			{
+				for (size_t s = 0; s < Usize; ++s)
+					bottom[s] = U[s];
+			}
+			if (mc > 0) frames.emplace_back(bottom, J); // roots and the children of the dense block have no update matrix
+			top = bottom + Usize;
+		}
+	}
+
+	// The block size of chol_dense. Two nb x nb tiles fit in 32KB of L1 cache.
+	template <typename Tx, typename Ti>
+	Ti dense_block_size()
+	{
+		Ti nb = Ti(std::sqrt(16384.0 / double(sizeof(Tx))));
+		return std::max(Ti(8), Ti(nb & ~Ti(3)));
+	}
+
+	// Compute the dense trailing block L(t:n, t:n) after the columns 0, ..., t-1 of L are computed.
+	// The entry (i, j) of the block is at Lx[Lp[j] + i - j], so no row indices are needed.
+	template <typename Tx, typename Ti, typename Source>
+	void chol_dense(CholOutput<Tx, Ti>& o, const Source& A)
+	{
+		Ti n = o.n, t = o.dense_start;
+		Ti* Lp = o.p.get(); Ti* Li = o.i.get();
+
+		Tx T0 = Tx(0), T1 = Tx(1);
+		Tx* Lx = o.x.get(), * Hdiag = o.Hdiag.get();
+		auto col = [Lx, Lp](Ti j) { return Lx + Lp[j] - j; };
+
+		// T = A(t:n, t:n)
+		for (Ti j = t; j < n; ++j)
+		{
+			Tx* Lj = col(j);
+			for (Ti i = j; i < n; ++i)
+				Lj[i] = T0;
+
+			A.lower(j, [Lj](Ti i) -> Tx& { return Lj[i]; });
+			Hdiag[j] = Lj[j];
+		}
+
+		// T -= L(t:n, 0:t) L(t:n, 0:t)'
+		for (Ti k = 0; k < t; ++k)
+		{
+			Ti p_end = Lp[k + 1];
+			Ti p_start = Ti(std::lower_bound(Li + Lp[k] + 1, Li + p_end, t) - Li);
+			for (Ti p = p_start; p < p_end; ++p)
+			{
+				Tx* Lj = col(Li[p]);
+				Tx Ljk = Lx[p];
+				for (Ti q = p; q < p_end; ++q)
+					fnmadd(Lj[Li[q]], Lx[q], Ljk);
+			}
+		}
+
+		// blocked right-looking cholesky on T
+		Ti nb = dense_block_size<Tx, Ti>();
+		for (Ti k0 = t; k0 < n; k0 += nb)
+		{
+			Ti k1 = std::min(k0 + nb, n);
+
+			// factorize the panel L(k0:n, k0:k1)
+			for (Ti j = k0; j < k1; ++j)
+			{
+				Tx* Lj = col(j);
+				for (Ti k = k0; k < j; ++k)
+				{
+					Tx* Lk = col(k);
+					Tx Ljk = Lk[j];
+					for (Ti i = j; i < n; ++i)
+						fnmadd(Lj[i], Lk[i], Ljk);
+				}
+
+				Tx Ljj = chol_pivot(o, j, Lj[j], o.npert[0]);
+				Lj[j] = Ljj;
+				Tx inv_Ljj = T1 / Ljj;
+				for (Ti i = j + 1; i < n; ++i)
+					Lj[i] *= inv_Ljj;
+			}
+
+			// L(k1:n, k1:n) -= L(k1:n, k0:k1) L(k1:n, k0:k1)' tile by tile
+			for (Ti j0 = k1; j0 < n; j0 += nb)
+			{
+				Ti j1 = std::min(j0 + nb, n);
+				for (Ti i0 = j0; i0 < n; i0 += nb)
+				{
+					Ti i1 = std::min(i0 + nb, n);
+					for (Ti j = j0; j < j1; ++j)
+					{
+						Tx* Lj = col(j);
+						Ti i_start = std::max(j, i0), k = k0;
+
+						// 4 columns of the panel at a time to load and store Lj less often
+						for (; k + 4 <= k1; k += 4)
+						{
+							Tx* L0 = col(k), * L1 = col(k + 1), * L2 = col(k + 2), * L3 = col(k + 3);
+							Tx a0 = L0[j], a1 = L1[j], a2 = L2[j], a3 = L3[j];
+							for (Ti i = i_start; i < i1; ++i)
+							{
+								Tx v = Lj[i];
+								fnmadd(v, L0[i], a0);
+								fnmadd(v, L1[i], a1);
+								fnmadd(v, L2[i], a2);
+								fnmadd(v, L3[i], a3);
+								Lj[i] = v;
+							}
+						}
+						for (; k < k1; ++k)
+						{
+							Tx* Lk = col(k);
+							Tx Ljk = Lk[j];
+							for (Ti i = i_start; i < i1; ++i)
+								fnmadd(Lj[i], Lk[i], Ljk);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// state of chol_autotune
+	template <typename Tx, typename Ti>
+	struct CholAutotune
+	{
+		static constexpr size_t ncandidates = 4;
+
+		size_t reps = 2;					// number of timed calls for each kernel (after one warm up call)
+		size_t calls = 0;
+		size_t current = ncandidates;		// the candidate whose factor is in the output
+		size_t best = ncandidates;			// the fastest candidate timed so far
+		double time[ncandidates] = {};
+		CholOutput<Tx, Ti> best_factor;		// the factor of best (the factors of slower candidates are freed once timed)
+
+		static CholMethod candidate(size_t c)
+		{
+			const CholMethod candidates[ncandidates] = {
+				CholMethod::Supernodal, CholMethod::Multifrontal, CholMethod::LeftLooking, CholMethod::UpLooking };
+			return candidates[c];
+		}
+
+		bool tuning() const
+		{
+			return calls < (reps + 1) * ncandidates;
+		}
+
+		CholMethod method() const
+		{
+			return current < ncandidates ? candidate(current) : CholMethod::Auto;
+		}
+	};
+
+	// Compute o = chol(H) with factor(o) and time the kernels during the first calls.
+	// Each kernel runs reps + 1 consecutive calls, so at most two factors are alive at a time.
+	// Returns true if the pattern of o may have changed since the last call.
+	template <typename Tx, typename Ti, typename Factor>
+	bool chol_autotune_general(CholAutotune<Tx, Ti>& t, CholOutput<Tx, Ti>& o, Factor factor)
+	{
+		constexpr size_t nc = CholAutotune<Tx, Ti>::ncandidates;
+		if (!t.tuning())
+		{
+			factor(o);
+			return false;
+		}
+
+		std::shared_ptr<ThreadPool> pool = o.pool;
+		double pivot_tol = o.pivot_tol;
+		std::string scratch_dir = o.scratch_dir;
+		auto setup = [&](size_t c)
+		{
+			o.method = t.candidate(c);
+			o.pool = pool;
+			o.pivot_tol = pivot_tol;
+			o.scratch_dir = scratch_dir;
+			t.current = c;
+		};
+
+		// keep the factor of the candidate timed last only if it is the fastest so far
+		auto retire = [&]()
+		{
+			if (t.current < nc && (t.best == nc || t.time[t.current] < t.time[t.best]))
+			{
+				std::swap(o, t.best_factor);
+				t.best = t.current;
+			}
+			o = CholOutput<Tx, Ti>();
+		};
+
+		size_t c = t.calls / (t.reps + 1);
+		bool changed = false;
+		if (c != t.current)
+		{
+			retire();
+			setup(c);
+			changed = true;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		factor(o);
+		auto end = std::chrono::steady_clock::now();
+		if (t.calls % (t.reps + 1) != 0) // the first call of each kernel is a warm up (and the symbolic analysis)
+			t.time[c] += std::chrono::duration<double>(end - start).count();
+
+		if (++t.calls == (t.reps + 1) * nc)
+		{
+			if (t.time[t.best] <= t.time[c])
+			{
+				std::swap(o, t.best_factor);
+				setup(t.best);
+				factor(o); // the factor of best is from an earlier call
+				changed = true;
+			}
+			t.best = t.current;
+			t.best_factor = CholOutput<Tx, Ti>();
+		}
+		return changed;
+	}
+
+	template <typename Tx, typename Ti>
+	bool chol_autotune(CholAutotune<Tx, Ti>& t, CholOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& A)
+	{
+		return chol_autotune_general(t, o, [&](CholOutput<Tx, Ti>& L) { chol(L, A); });
+	}
+
+	// chol_autotune for H = A diag(w) A' (see FusedColumns)
+	template <typename Tx, typename Ti, typename Tx2>
+	bool chol_autotune(CholAutotune<Tx, Ti>& t, CholOutput<Tx, Ti>& o, const SparseMatrix<Tx2, Ti>& A, const Tx* w, const SparseMatrix<Tx2, Ti>& At)
+	{
+		return chol_autotune_general(t, o, [&](CholOutput<Tx, Ti>& L) { chol(L, A, w, At); });
+	}
+
 	template <typename Tx, typename Ti>
 	CholOutput<Tx, Ti> chol(const SparseMatrix<Tx, Ti>& A)
 	{
@@ -0,0 +1,60 @@
+#pragma once
+#include "SparseMatrix.h"
+#include "chol.h"
+
+// Problem:
+// Given L = chol(H), compute chol(H + alpha a_j a_j') in place where a_j is the j-th column of A
+
+// Algorithm:
+// Write L = Lu D^(1/2) with Lu unit lower triangular and apply the rank-one update of Bennett to (Lu, D).
+// The nonzeros of x = Lu^{-1} a_j lie on the path from the first row of a_j to the root of the
+// elimination tree, which is the path k -> the first off-diagonal row of L(:, k). So the cost is
+// the number of nonzeros of L in the columns on this path instead of the cost of the full chol.
+// alpha can be negative (downdate) and can differ among the lanes. If some lane of H + alpha a_j a_j'
+// is not positive definite, its diagonal becomes 0 and the caller should refactorize.
+
+namespace PackedCSparse {
+	template <typename Tx, typename Ti, typename Tx2>
+	void cholupdate(CholOutput<Tx, Ti>& o, const SparseMatrix<Tx2, Ti>& A, Ti j, Tx alpha)
+	{
+		pcs_assert(o.initialized() && A.initialized(), "cholupdate: bad inputs.");
+		pcs_assert(o.n == A.m, "cholupdate: dimensions mismatch.");
+
+		Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx2* Ax = A.x.get();
+		Ti* Lp = o.p.get(), * Li = o.i.get(); Tx* Lx = o.x.get();
+		Tx* x = o.w.get(); // o.w is 0 outside chol
+
+		if (Ap[j] == Ap[j + 1]) return;
+
+		Tx T0 = Tx(0.0), T1 = Tx(1.0);
+		Ti k = Ai[Ap[j]];
+		for (Ti s = Ap[j]; s < Ap[j + 1]; ++s)
+			x[Ai[s]] = Tx(Ax[s]);
+
+		while (k != -1)
+		{
+			Ti p = Lp[k], p_end = Lp[k + 1];
+			Tx Lkk = Lx[p], xk = x[k];
+			x[k] = T0;
+
+			// d = D_kk, d_new = d + alpha x_k^2
+			Tx d = Lkk * Lkk, d_new = d, alpha_xk = alpha * xk;
+			fmadd(d_new, alpha_xk, xk);
+			Tx Lkk_new = clipped_sqrt(d_new, 0.0);
+			Tx gamma = alpha_xk / d_new, inv_Lkk = T1 / Lkk;
+			Lx[p] = Lkk_new;
+
+			for (Ti q = p + 1; q < p_end; ++q)
+			{
+				Ti i = Li[q];
+				Tx lu = Lx[q] * inv_Lkk;
+				fnmadd(x[i], xk, lu);
+				fmadd(lu, gamma, x[i]);
+				Lx[q] = lu * Lkk_new;
+			}
+			alpha = alpha * d / d_new;
+
+			k = (p + 1 < p_end) ? Li[p + 1] : -1;
+		}
+	}
+}
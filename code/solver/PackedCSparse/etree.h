@@ -0,0 +1,217 @@
+#pragma once
+#include "SparseMatrix.h"
+
+// Problem:
+// Compute the symbolic information of chol(A) without forming L
+
+// Algorithm:
+// etree:
+//		Liu's algorithm with path compression on the ancestors. O(nnz(A) log n).
+// postorder:
+//		Depth-first search of the elimination tree.
+// colcounts:
+//		Gilbert, Ng and Peyton. The row subtrees are represented by their leaves
+//		and the overlaps are removed with least common ancestors. O(nnz(A) alpha(n)).
+// ereach:
+//		The nonzero pattern of the k-th row of L is the subtree of the elimination tree
+//		reachable from the pattern of A(0:k-1, k).
+// etree_reach:
+//		The nonzero pattern of L^{-1} b is the union of the paths from the nonzeros of b to the root
+//		of the elimination tree (Gilbert and Peierls, specialized to the tree).
+//
+// All functions assume A has a symmetric pattern and read only its upper triangular part.
+
+namespace PackedCSparse {
+	template <typename Tx, typename Ti>
+	UniquePtr<Ti> etree(const SparseMatrix<Tx, Ti>& A)
+	{
+		pcs_assert(A.initialized(), "etree: bad inputs.");
+		pcs_assert(A.n == A.m, "etree: dimensions mismatch.");
+
+		Ti n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+		UniquePtr<Ti> parent(new Ti[n]);
+		Ti* ancestor = new Ti[n];
+
+		for (Ti k = 0; k < n; k++)
+		{
+			parent[k] = -1;
+			ancestor[k] = -1;
+			for (Ti p = Ap[k]; p < Ap[k + 1]; p++)
+			{
+				Ti i = Ai[p], inext;
+				for (; i != -1 && i < k; i = inext)
+				{
+					inext = ancestor[i];
+					ancestor[i] = k;
+					if (inext == -1) parent[i] = k;
+				}
+			}
+		}
+
+		delete[] ancestor;
+		return parent;
+	}
+
+	template <typename Ti>
+	UniquePtr<Ti> postorder(const Ti* parent, Ti n)
+	{
+		UniquePtr<Ti> post(new Ti[n]);
+		Ti* head = new Ti[n], * next = new Ti[n], * stack = new Ti[n];
+
+		for (Ti j = 0; j < n; j++)
+			head[j] = -1;
+
+		// traverse in reverse so that children are visited in increasing order
+		for (Ti j = n - 1; j >= 0; j--)
+		{
+			if (parent[j] == -1) continue;
+			next[j] = head[parent[j]];
+			head[parent[j]] = j;
+		}
+
+		Ti k = 0;
+		for (Ti j = 0; j < n; j++)
+		{
+			if (parent[j] != -1) continue;
+
+			Ti top = 0;
+			stack[0] = j;
+			while (top >= 0)
+			{
+				Ti p = stack[top], i = head[p];
+				if (i == -1)
+				{
+					top--;
+					post[k++] = p;
+				}
+				else
+				{
+					head[p] = next[i];
+					stack[++top] = i;
+				}
+			}
+		}
+
+		delete[] head; delete[] next; delete[] stack;
+		return post;
+	}
+
+	// colcount[j] = nnz(L(:, j)) including the diagonal
+	template <typename Tx, typename Ti>
+	UniquePtr<Ti> colcounts(const SparseMatrix<Tx, Ti>& A, const Ti* parent, const Ti* post)
+	{
+		Ti n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+		UniquePtr<Ti> colcount(new Ti[n]);
+		Ti* delta = colcount.get();
+		Ti* w = new Ti[4 * size_t(n)];
+		Ti* ancestor = w, * maxfirst = w + n, * prevleaf = w + 2 * n, * first = w + 3 * n;
+
+		for (Ti k = 0; k < 4 * n; k++)
+			w[k] = -1;
+
+		// first[j] = the first descendant of j in the postorder
+		for (Ti k = 0; k < n; k++)
+		{
+			Ti j = post[k];
+			delta[j] = (first[j] == -1) ? 1 : 0; // j is a leaf
+			for (; j != -1 && first[j] == -1; j = parent[j])
+				first[j] = k;
+		}
+
+		for (Ti i = 0; i < n; i++)
+			ancestor[i] = i;
+
+		for (Ti k = 0; k < n; k++)
+		{
+			Ti j = post[k];
+			if (parent[j] != -1) delta[parent[j]]--;
+
+			// for each i with A(i, j) != 0 and i > j, determine if j is a leaf of the i-th row subtree
+			for (Ti p = Ap[j]; p < Ap[j + 1]; p++)
+			{
+				Ti i = Ai[p];
+				if (i <= j || first[j] <= maxfirst[i]) continue;
+
+				maxfirst[i] = first[j];
+				Ti jprev = prevleaf[i];
+				prevleaf[i] = j;
+				if (jprev == -1)
+				{	// j is the first leaf
+					delta[j]++;
+					continue;
+				}
+
+				// q = least common ancestor of jprev and j
+				Ti q = jprev;
+				for (; q != ancestor[q]; q = ancestor[q]);
+				for (Ti s = jprev, sparent; s != q; s = sparent)
+				{
+					sparent = ancestor[s];
+					ancestor[s] = q;
+				}
+
+				delta[j]++;
+				delta[q]--;
+			}
+			if (parent[j] != -1) ancestor[j] = parent[j];
+		}
+
+		// sum up the delta of each subtree
+		for (Ti j = 0; j < n; j++)
+		{
+			if (parent[j] != -1) colcount[parent[j]] += colcount[j];
+		}
+
+		delete[] w;
+		return colcount;
+	}
+
+	// Output: s[top...n-1] is the pattern of L(k, 0:k-1). Returns top.
+	// flag is a size n workspace with flag[i] != k for all i before the call.
+	template <typename Tx, typename Ti>
+	Ti ereach(const SparseMatrix<Tx, Ti>& A, Ti k, const Ti* parent, Ti* s, Ti* flag)
+	{
+		Ti n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+		Ti top = n;
+		flag[k] = k;
+		for (Ti p = Ap[k]; p < Ap[k + 1]; p++)
+		{
+			Ti i = Ai[p];
+			if (i > k) continue;
+
+			// walk up the tree until we hit a visited node
+			Ti len = 0;
+			for (; flag[i] != k; i = parent[i])
+			{
+				s[len++] = i;
+				flag[i] = k;
+			}
+			while (len > 0) s[--top] = s[--len];
+		}
+		return top;
+	}
+
+	// Output: s[top...n-1] is the union of the paths from the rows bi[0], ..., bi[nb-1] to the root,
+	// listed so that every column comes before its ancestors. Returns top.
+	// flag is a size n workspace with flag[i] == false for all i, which holds again after the call.
+	template <typename Ti>
+	Ti etree_reach(const Ti* parent, Ti n, const Ti* bi, Ti nb, Ti* s, bool* flag)
+	{
+		Ti top = n;
+		for (Ti p = 0; p < nb; p++)
+		{
+			// walk up the tree until we hit a visited node
+			Ti len = 0;
+			for (Ti i = bi[p]; i != -1 && !flag[i]; i = parent[i])
+			{
+				s[len++] = i;
+				flag[i] = true;
+			}
+			while (len > 0) s[--top] = s[--len];
+		}
+
+		for (Ti p = top; p < n; p++)
+			flag[s[p]] = false;
+		return top;
+	}
+}
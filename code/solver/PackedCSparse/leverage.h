@@ -2,6 +2,7 @@
 #include "SparseMatrix.h"
 #include "projinv.h"
 #include "outerprod.h"
+#include "parallel.h"
 
 // Problem:
 // Compute M = diag(A' inv(LL') A)
@@ -26,19 +27,32 @@ namespace PackedCSparse {
 
 	template<typename Tx, typename Ti, typename Tx2>
 	void leverage(LeverageOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& L, const SparseMatrix<Tx2, Ti>& A, const SparseMatrix<Tx2, Ti>& At)
+	{
+		leverage(o, L, A, At, BlockRanges<Ti>(L.n));
+	}
+
+	// The ranges of rows of L are independent (see CholOutput::block_tasks), so each range
+	// runs projinv and outerprod on its own rows and constraints.
+	template<typename Tx, typename Ti, typename Tx2>
+	void leverage(LeverageOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& L, const SparseMatrix<Tx2, Ti>& A, const SparseMatrix<Tx2, Ti>& At, const BlockRanges<Ti>& ranges)
 	{
 		if (!o.initialized())
 			o.initialize(L, A, At);
 
-		Tx T1 = Tx(1.0), T2 = Tx(2.0);
-		projinv(o.Hinv, L);
+		Tx T2 = Tx(2.0);
+		Ti n = A.n;
+		std::fill(o.tau.s_mark.get(), o.tau.s_mark.get() + L.n, Ti(-1));
+		std::fill(o.tau.x.get(), o.tau.x.get() + n, Tx(0.0));
+
+		ranges.run([&o, &L, &A, &At, T2](Ti k0, Ti k1, size_t) {
+			projinv(o.Hinv, L, k0, k1);
 
-		Ti m = A.m, n = A.n;
-		Ti* Sp = o.Hinv.p.get(); Tx* Sv = o.Hinv.x.get();
-		for (Ti k = 0; k < m; ++k)
-			Sv[Sp[k]] /= T2;
+			Ti* Sp = o.Hinv.p.get(); Tx* Sv = o.Hinv.x.get();
+			for (Ti k = k0; k < k1; ++k)
+				Sv[Sp[k]] /= T2;
 
-		outerprod(o.tau, A, o.Hinv, At);
+			outerprod(o.tau, A, o.Hinv, At, k0, k1);
+		});
 
 		Tx* x = o.x.get(), * tau = o.tau.x.get();
 		for (Ti j = 0; j < n; j++)
@@ -1,6 +1,7 @@
 #pragma once
 #include <random>
 #include "SparseMatrix.h"
+#include "trisolve.h"
 
 // Problem:
 // Approximate M = diag(A' inv(LL') A)
@@ -15,6 +16,8 @@ namespace PackedCSparse {
 		UniqueAlignedPtr<Tx> AtL_d;	// A' L^{-1} d
 		Ti m = 0;
 		std::mt19937_64 gen;
+		const SolveSchedule<Ti>* schedule = nullptr;	// the schedule of ltsolve with L (null = single threaded)
+		Ti dense_start = -1;							// the dense trailing block of L (see CholOutput::dense_start, -1 = none)
 
 		template<typename Tx2>
 		void initialize(const SparseMatrix<Tx, Ti>& L, const SparseMatrix<Tx2, Ti>& A, const SparseMatrix<Tx2, Ti>& At)
@@ -43,7 +46,10 @@ namespace PackedCSparse {
 		for (Ti i = 0; i < n * k; i++)
 			AtL_d[i] = T0;
 
-		ltsolve(L, (BaseImpl<Tx, k>*)d, (BaseImpl<Tx, k>*)L_d);
+		if (o.schedule)
+			ltsolve(L, *o.schedule, (BaseImpl<Tx, k>*)d, (BaseImpl<Tx, k>*)L_d);
+		else
+			ltsolve(L, (BaseImpl<Tx, k>*)d, (BaseImpl<Tx, k>*)L_d, Ti(0), L.n, o.dense_start < 0 ? L.n : o.dense_start);
 		gaxpy(At, (BaseImpl<Tx, k>*)L_d, (BaseImpl<Tx, k>*)AtL_d);
 
 		for (Ti i = 0; i < n; i++)
@@ -109,7 +115,10 @@ namespace PackedCSparse {
 		for (Ti i = 0; i < n * k_; i++)
 			AtL_d[i] = T0;
 
-		ltsolve(L, (BaseImpl<Tx, k_>*)d, (BaseImpl<Tx, k_>*)L_d);
+		if (o.schedule)
+			ltsolve(L, *o.schedule, (BaseImpl<Tx, k_>*)d, (BaseImpl<Tx, k_>*)L_d);
+		else
+			ltsolve(L, (BaseImpl<Tx, k_>*)d, (BaseImpl<Tx, k_>*)L_d, Ti(0), L.n, o.dense_start < 0 ? L.n : o.dense_start);
 		gaxpy(At, (BaseImpl<Tx, k_>*)L_d, (BaseImpl<Tx, k_>*)AtL_d);
 		
 		Tx result[k];
@@ -8,12 +8,19 @@
 
 // Algorithm:
 // Compute M col by col
+// In the lower mode, only the rows i >= j of the column j are computed and stored, which halves the
+// work and the memory for a symmetric product A diag(w) A'. The rows of A must be sorted.
+// The lower mode only matters where H is stored. The fused assembly of chol (FusedColumns) does not
+// store H and already computes only the rows i >= j (or i <= j) of each column it reads.
 
 namespace PackedCSparse {
 	template <typename Tx, typename Ti>
 	struct MultiplyOutput : SparseMatrix<Tx, Ti>
 	{
 		UniqueAlignedPtr<Tx> c;
+		bool lower = false;				// compute and store only the lower triangle (set before the first multiply)
+		SparseMatrix<bool, Ti> upper;	// if lower, the pattern of the upper triangle, i.e. the rows of the lower one
+		SharedPtr<Ti> upper_s;			// if lower, the entry upper.i[q] of the column j of upper is x[upper_s[q]]
 
 		template<typename Tx2>
 		void initialize(const SparseMatrix<Tx2, Ti>& A, const SparseMatrix<Tx2, Ti>& B)
@@ -43,7 +50,8 @@ namespace PackedCSparse {
 				for (Ti p1 = Bp[j1]; p1 < Bp[j1 + 1]; p1++)
 				{
 					Ti j2 = Bi[p1];
-					for (Ti p2 = Ap[j2]; p2 < Ap[j2 + 1]; p2++)
+					Ti p2_start = lower ? Ti(std::lower_bound(Ai + Ap[j2], Ai + Ap[j2 + 1], j1) - Ai) : Ap[j2];
+					for (Ti p2 = p2_start; p2 < Ap[j2 + 1]; p2++)
 					{
 						Ti i = Ai[p2];
 						if (last_j[i] != j1)
@@ -65,6 +73,54 @@ namespace PackedCSparse {
 			this->p.reset(Cp);
 			this->i.reset(new Ti[Ci.size()]);
 			std::copy(Ci.begin(), Ci.end(), this->i.get());
+
+			if (lower)
+				initialize_upper();
+		}
+
+		// the rows of the lower triangle as the columns of the upper one
+		void initialize_upper()
+		{
+			Ti n = this->n, nz = this->nnz(), * Cp = this->p.get(), * Ci = this->i.get();
+			upper.initialize(n, n, nz);
+			upper_s.reset(new Ti[nz > 0 ? nz : 1]);
+			Ti* Up = upper.p.get(), * Ui = upper.i.get();
+
+			std::vector<Ti> next(size_t(n) + 1, 0);
+			for (Ti s = 0; s < nz; s++)
+				next[Ci[s] + 1]++;
+			for (Ti i = 0; i < n; i++)
+				next[i + 1] += next[i];
+			std::copy(next.begin(), next.end(), Up);
+
+			for (Ti j = 0; j < n; j++)
+			{
+				for (Ti s = Cp[j]; s < Cp[j + 1]; s++)
+				{
+					Ti q = next[Ci[s]]++;
+					Ui[q] = j;
+					upper_s[q] = s;
+				}
+			}
+		}
+
+		// the pattern of the whole symmetric matrix (for the symbolic analysis of a lower triangle)
+		SparseMatrix<bool, Ti> symmetric_pattern() const
+		{
+			Ti n = this->n, * Cp = this->p.get(), * Ci = this->i.get();
+			Ti* Up = upper.p.get(), * Ui = upper.i.get();
+			SparseMatrix<bool, Ti> S(n, n, 2 * this->nnz());
+			Ti* Sp = S.p.get(), * Si = S.i.get(), nz = 0;
+			for (Ti j = 0; j < n; j++)
+			{
+				Sp[j] = nz;
+				for (Ti q = Up[j]; q < Up[j + 1]; q++)
+					if (Ui[q] != j) Si[nz++] = Ui[q];
+				for (Ti s = Cp[j]; s < Cp[j + 1]; s++)
+					Si[nz++] = Ci[s];
+			}
+			Sp[n] = nz;
+			return S;
 		}
 	};
 
@@ -74,7 +130,7 @@ namespace PackedCSparse {
 		if (!o.initialized())
 			o.initialize(A, B);
 
-		Ti m = o.m, n = o.n;
+		Ti n = o.n;
 		Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx* Ax = A.x.get();
 		Ti* Bp = B.p.get(), * Bi = B.i.get(); Tx* Bx = B.x.get();
 		Ti* Cp = o.p.get(), * Ci = o.i.get(); Tx2* Cx = o.x.get();
@@ -88,7 +144,8 @@ namespace PackedCSparse {
 				Ti j2 = Bi[p1];
 				Tx2 beta = has_weight? (Tx2(Bx[p1]) * w[j2]) : Tx2(Bx[p1]);
 
-				for (Ti p2 = Ap[j2]; p2 < Ap[j2 + 1]; p2++)
+				Ti p2_start = o.lower ? Ti(std::lower_bound(Ai + Ap[j2], Ai + Ap[j2 + 1], j1) - Ai) : Ap[j2];
+				for (Ti p2 = p2_start; p2 < Ap[j2 + 1]; p2++)
 				{
 					//x[Ai[p2]] += beta * Ax[p2];
 					fmadd(c[Ai[p2]], beta, Ax[p2]);
@@ -0,0 +1,661 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "SparseMatrix.h"
+
+// Problem:
+// Find a permutation P such that chol(H(P,P)) has few nonzeros.
+
+// Algorithm:
+// amd:
+//		Approximate minimum degree ordering (Amestoy, Davis and Duff) on the quotient graph.
+//		This is a port of cs_amd in CSparse with element absorption, mass elimination,
+//		supernode detection via hashing and dense row removal.
+//
+// nested_dissection:
+//		Recursively split the graph of H by a vertex separator and order the separator last.
+//		The separator is a level of the breadth-first search from a pseudo-peripheral node,
+//		chosen to minimize |separator| / min(|part 1|, |part 2|). Small subgraphs are ordered by amd.
+//		This gives wider and more balanced elimination trees than amd on large problems.
+
+namespace PackedCSparse {
+	enum class Ordering
+	{
+		Natural = 0,
+		AMD = 1,
+		NestedDissection = 2
+	};
+
+	namespace amd_detail {
+		template <typename Ti>
+		inline Ti flip(Ti i) { return -i - 2; }
+
+		// clear w if mark overflows
+		template <typename Ti>
+		Ti wclear(Ti mark, Ti lemax, Ti* w, Ti n)
+		{
+			if (mark < 2 || (mark + lemax < 0))
+			{
+				for (Ti k = 0; k < n; k++)
+					if (w[k] != 0) w[k] = 1;
+				mark = 2;
+			}
+			return mark;
+		}
+
+		// depth-first search and postorder of a tree rooted at node j
+		template <typename Ti>
+		Ti tdfs(Ti j, Ti k, Ti* head, const Ti* next, Ti* post, Ti* stack)
+		{
+			Ti top = 0;
+			stack[0] = j;
+			while (top >= 0)
+			{
+				Ti p = stack[top];
+				Ti i = head[p];
+				if (i == -1)
+				{
+					top--;
+					post[k++] = p;
+				}
+				else
+				{
+					head[p] = next[i];
+					stack[++top] = i;
+				}
+			}
+			return k;
+		}
+	}
+
+	// Input: A with symmetric sparsity pattern (the values and the diagonal are ignored)
+	// Output: perm such that A(perm, perm) has a sparse cholesky factor
+	template <typename Tx, typename Ti>
+	UniquePtr<Ti> amd(const SparseMatrix<Tx, Ti>& A)
+	{
+		using namespace amd_detail;
+		pcs_assert(A.initialized(), "amd: bad inputs.");
+		pcs_assert(A.n == A.m, "amd: dimensions mismatch.");
+
+		Ti n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+		UniquePtr<Ti> P(new Ti[size_t(n) + 1]);
+		if (n == 0) return P;
+
+		// C = A without the diagonal, with elbow room
+		Ti cnz = 0;
+		for (Ti j = 0; j < n; j++)
+			for (Ti p = Ap[j]; p < Ap[j + 1]; p++)
+				if (Ai[p] != j) cnz++;
+
+		Ti nzmax = cnz + cnz / 5 + 2 * n;
+		Ti* Cp = new Ti[size_t(n) + 1];
+		Ti* Ci = new Ti[nzmax];
+		cnz = 0;
+		for (Ti j = 0; j < n; j++)
+		{
+			Cp[j] = cnz;
+			for (Ti p = Ap[j]; p < Ap[j + 1]; p++)
+				if (Ai[p] != j) Ci[cnz++] = Ai[p];
+		}
+		Cp[n] = cnz;
+
+		Ti dense = std::max(Ti(16), Ti(10 * std::sqrt(double(n))));
+		dense = std::min(n - 2, dense);
+
+		Ti* W = new Ti[8 * (size_t(n) + 1)];
+		Ti* len = W, * nv = W + (n + 1), * next = W + 2 * (n + 1), * head = W + 3 * (n + 1);
+		Ti* elen = W + 4 * (n + 1), * degree = W + 5 * (n + 1), * w = W + 6 * (n + 1), * hhead = W + 7 * (n + 1);
+		Ti* last = P.get(); // use P as workspace for last
+
+		// initialize quotient graph
+		for (Ti k = 0; k < n; k++)
+			len[k] = Cp[k + 1] - Cp[k];
+		len[n] = 0;
+		for (Ti i = 0; i <= n; i++)
+		{
+			head[i] = -1; last[i] = -1; next[i] = -1; hhead[i] = -1;
+			nv[i] = 1; w[i] = 1; elen[i] = 0; degree[i] = len[i];
+		}
+		Ti mark = wclear(Ti(0), Ti(0), w, n);
+		elen[n] = -2; Cp[n] = -1; w[n] = 0;
+
+		// initialize degree lists
+		Ti nel = 0, mindeg = 0, lemax = 0;
+		for (Ti i = 0; i < n; i++)
+		{
+			Ti d = degree[i];
+			if (d == 0)
+			{	// node i is empty
+				elen[i] = -2; nel++; Cp[i] = -1; w[i] = 0;
+			}
+			else if (d > dense)
+			{	// node i is dense, absorb it into element n
+				nv[i] = 0; elen[i] = -1; nel++; Cp[i] = flip(n); nv[n]++;
+			}
+			else
+			{
+				if (head[d] != -1) last[head[d]] = i;
+				next[i] = head[d];
+				head[d] = i;
+			}
+		}
+
+		while (nel < n)
+		{
+			// select node of minimum approximate degree
+			Ti k = -1;
+			for (; mindeg < n && (k = head[mindeg]) == -1; mindeg++);
+			if (next[k] != -1) last[next[k]] = -1;
+			head[mindeg] = next[k];
+			Ti elenk = elen[k], nvk = nv[k];
+			nel += nvk;
+
+			// garbage collection
+			if (elenk > 0 && cnz + mindeg >= nzmax)
+			{
+				for (Ti j = 0; j < n; j++)
+				{
+					Ti p = Cp[j];
+					if (p >= 0)
+					{
+						Cp[j] = Ci[p];
+						Ci[p] = flip(j);
+					}
+				}
+				Ti q = 0;
+				for (Ti p = 0; p < cnz; )
+				{
+					Ti j = flip(Ci[p++]);
+					if (j >= 0)
+					{
+						Ci[q] = Cp[j];
+						Cp[j] = q++;
+						for (Ti k3 = 0; k3 < len[j] - 1; k3++) Ci[q++] = Ci[p++];
+					}
+				}
+				cnz = q;
+			}
+
+			// construct new element
+			Ti dk = 0;
+			nv[k] = -nvk;
+			Ti p = Cp[k];
+			Ti pk1 = (elenk == 0) ? p : cnz;
+			Ti pk2 = pk1;
+			for (Ti k1 = 1; k1 <= elenk + 1; k1++)
+			{
+				Ti e, pj, ln;
+				if (k1 > elenk)
+				{
+					e = k; pj = p; ln = len[k] - elenk;
+				}
+				else
+				{
+					e = Ci[p++]; pj = Cp[e]; ln = len[e];
+				}
+				for (Ti k2 = 1; k2 <= ln; k2++)
+				{
+					Ti i = Ci[pj++], nvi = nv[i];
+					if (nvi <= 0) continue;
+					dk += nvi;
+					nv[i] = -nvi;
+					Ci[pk2++] = i;
+					if (next[i] != -1) last[next[i]] = last[i];
+					if (last[i] != -1)
+						next[last[i]] = next[i];
+					else
+						head[degree[i]] = next[i];
+				}
+				if (e != k)
+				{	// absorb e into k
+					Cp[e] = flip(k);
+					w[e] = 0;
+				}
+			}
+			if (elenk != 0) cnz = pk2;
+			degree[k] = dk;
+			Cp[k] = pk1;
+			len[k] = pk2 - pk1;
+			elen[k] = -2;
+
+			// find set differences |Le\Lk|
+			mark = wclear(mark, lemax, w, n);
+			for (Ti pk = pk1; pk < pk2; pk++)
+			{
+				Ti i = Ci[pk], eln = elen[i];
+				if (eln <= 0) continue;
+				Ti nvi = -nv[i], wnvi = mark - nvi;
+				for (p = Cp[i]; p <= Cp[i] + eln - 1; p++)
+				{
+					Ti e = Ci[p];
+					if (w[e] >= mark)
+						w[e] -= nvi;
+					else if (w[e] != 0)
+						w[e] = degree[e] + wnvi;
+				}
+			}
+
+			// degree update
+			for (Ti pk = pk1; pk < pk2; pk++)
+			{
+				Ti i = Ci[pk];
+				Ti p1 = Cp[i], p2 = p1 + elen[i] - 1, pn = p1;
+				Ti h = 0, d = 0;
+				for (p = p1; p <= p2; p++)
+				{
+					Ti e = Ci[p];
+					if (w[e] != 0)
+					{
+						Ti dext = w[e] - mark;
+						if (dext > 0)
+						{
+							d += dext;
+							Ci[pn++] = e;
+							h += e;
+						}
+						else
+						{	// aggressive absorption
+							Cp[e] = flip(k);
+							w[e] = 0;
+						}
+					}
+				}
+				elen[i] = pn - p1 + 1;
+				Ti p3 = pn, p4 = p1 + len[i];
+				for (p = p2 + 1; p < p4; p++)
+				{	// prune edges
+					Ti j = Ci[p], nvj = nv[j];
+					if (nvj <= 0) continue;
+					d += nvj;
+					Ci[pn++] = j;
+					h += j;
+				}
+				if (d == 0)
+				{	// mass elimination
+					Cp[i] = flip(k);
+					Ti nvi = -nv[i];
+					dk -= nvi; nvk += nvi; nel += nvi;
+					nv[i] = 0; elen[i] = -1;
+				}
+				else
+				{
+					degree[i] = std::min(degree[i], d);
+					Ci[pn] = Ci[p3];
+					Ci[p3] = Ci[p1];
+					Ci[p1] = k;
+					len[i] = pn - p1 + 1;
+					h = ((h < 0) ? (-h) : h) % n;
+					next[i] = hhead[h];
+					hhead[h] = i;
+					last[i] = h;
+				}
+			}
+			degree[k] = dk;
+			lemax = std::max(lemax, dk);
+			mark = wclear(mark + lemax, lemax, w, n);
+
+			// supernode detection
+			for (Ti pk = pk1; pk < pk2; pk++)
+			{
+				Ti i = Ci[pk];
+				if (nv[i] >= 0) continue;
+				Ti h = last[i];
+				i = hhead[h];
+				hhead[h] = -1;
+				for (; i != -1 && next[i] != -1; i = next[i], mark++)
+				{
+					Ti ln = len[i], eln = elen[i];
+					for (p = Cp[i] + 1; p <= Cp[i] + ln - 1; p++) w[Ci[p]] = mark;
+					Ti jlast = i;
+					for (Ti j = next[i]; j != -1; )
+					{
+						bool ok = (len[j] == ln) && (elen[j] == eln);
+						for (p = Cp[j] + 1; ok && p <= Cp[j] + ln - 1; p++)
+							if (w[Ci[p]] != mark) ok = false;
+						if (ok)
+						{	// absorb j into i
+							Cp[j] = flip(i);
+							nv[i] += nv[j];
+							nv[j] = 0;
+							elen[j] = -1;
+							j = next[j];
+							next[jlast] = j;
+						}
+						else
+						{
+							jlast = j;
+							j = next[j];
+						}
+					}
+				}
+			}
+
+			// finalize new element
+			Ti pk;
+			for (p = pk1, pk = pk1; pk < pk2; pk++)
+			{
+				Ti i = Ci[pk], nvi = -nv[i];
+				if (nvi <= 0) continue;
+				nv[i] = nvi;
+				Ti d = degree[i] + dk - nvi;
+				d = std::min(d, n - nel - nvi);
+				if (head[d] != -1) last[head[d]] = i;
+				next[i] = head[d];
+				last[i] = -1;
+				head[d] = i;
+				mindeg = std::min(mindeg, d);
+				degree[i] = d;
+				Ci[p++] = i;
+			}
+			nv[k] = nvk;
+			if ((len[k] = p - pk1) == 0)
+			{
+				Cp[k] = -1;
+				w[k] = 0;
+			}
+			if (elenk != 0) cnz = p;
+		}
+
+		// postorder the assembly tree
+		for (Ti i = 0; i < n; i++) Cp[i] = flip(Cp[i]);
+		for (Ti j = 0; j <= n; j++) head[j] = -1;
+		for (Ti j = n; j >= 0; j--)
+		{
+			if (nv[j] > 0) continue;
+			next[j] = head[Cp[j]];
+			head[Cp[j]] = j;
+		}
+		for (Ti e = n; e >= 0; e--)
+		{
+			if (nv[e] <= 0) continue;
+			if (Cp[e] != -1)
+			{
+				next[e] = head[Cp[e]];
+				head[Cp[e]] = e;
+			}
+		}
+		for (Ti k = 0, i = 0; i <= n; i++)
+		{
+			if (Cp[i] == -1) k = tdfs(i, k, head, next, P.get(), w);
+		}
+
+		delete[] W;
+		delete[] Ci;
+		delete[] Cp;
+		return P;
+	}
+
+	template <typename Ti>
+	struct NestedDissection
+	{
+		Ti n = 0;
+		const Ti* Cp = nullptr, * Ci = nullptr;	// graph without the diagonal
+		Ti* perm = nullptr;
+		Ti leaf_size = 256;
+
+		std::vector<Ti> mark;	// mark[v] == stamp if v is in the current subgraph
+		std::vector<Ti> level;	// level of v in the breadth-first search
+		std::vector<Ti> queue;
+		Ti stamp = 0;
+
+		// breadth-first search in the subgraph marked by stamp. Returns the number of nodes visited
+		// and the number of levels. The nodes are stored in queue by levels.
+		Ti bfs(Ti root, Ti& nlevel)
+		{
+			Ti head = 0, tail = 0;
+			queue[tail++] = root;
+			level[root] = 0;
+			mark[root] = -stamp; // visited
+			nlevel = 1;
+			while (head < tail)
+			{
+				Ti v = queue[head++];
+				for (Ti p = Cp[v]; p < Cp[v + 1]; p++)
+				{
+					Ti u = Ci[p];
+					if (mark[u] != stamp) continue;
+					mark[u] = -stamp;
+					level[u] = level[v] + 1;
+					nlevel = std::max(nlevel, level[u] + 1);
+					queue[tail++] = u;
+				}
+			}
+
+			for (Ti k = 0; k < tail; k++)
+				mark[queue[k]] = stamp;
+			return tail;
+		}
+
+		Ti degree(Ti v)
+		{
+			Ti d = 0;
+			for (Ti p = Cp[v]; p < Cp[v + 1]; p++)
+				d += (mark[Ci[p]] == stamp);
+			return d;
+		}
+
+		void order_leaf(const std::vector<Ti>& nodes, Ti offset)
+		{
+			Ti nv = Ti(nodes.size());
+			++stamp;
+			for (Ti k = 0; k < nv; k++)
+			{
+				mark[nodes[k]] = stamp;
+				level[nodes[k]] = k; // local index
+			}
+
+			Ti nz = 0;
+			for (Ti v : nodes)
+				nz += degree(v);
+
+			SparseMatrix<bool, Ti> G(nv, nv, nz);
+			nz = 0;
+			for (Ti k = 0; k < nv; k++)
+			{
+				G.p[k] = nz;
+				Ti v = nodes[k];
+				for (Ti p = Cp[v]; p < Cp[v + 1]; p++)
+					if (mark[Ci[p]] == stamp) G.i[nz++] = level[Ci[p]];
+			}
+			G.p[nv] = nz;
+
+			UniquePtr<Ti> P = amd(G);
+			for (Ti k = 0; k < nv; k++)
+				perm[offset + k] = nodes[P[k]];
+		}
+
+		void order(const std::vector<Ti>& nodes, Ti offset)
+		{
+			Ti nv = Ti(nodes.size());
+			if (nv <= leaf_size)
+			{
+				order_leaf(nodes, offset);
+				return;
+			}
+
+			++stamp;
+			Ti my_stamp = stamp;
+			for (Ti v : nodes)
+				mark[v] = stamp;
+
+			// if the subgraph is disconnected, order each component separately
+			Ti nlevel, cnt = bfs(nodes[0], nlevel);
+			if (cnt < nv)
+			{
+				std::vector<std::vector<Ti>> comps;
+				for (Ti v : nodes)
+				{
+					if (mark[v] != my_stamp) continue;
+					stamp = my_stamp;
+					Ti c = bfs(v, nlevel);
+					comps.emplace_back(queue.begin(), queue.begin() + c);
+					for (Ti k = 0; k < c; k++)
+						mark[queue[k]] = -1;
+				}
+				for (auto& comp : comps)
+				{
+					order(comp, offset);
+					offset += Ti(comp.size());
+				}
+				return;
+			}
+
+			// find a pseudo-peripheral node
+			Ti root = nodes[0];
+			for (int it = 0; it < 8; it++)
+			{
+				Ti new_root = root, min_deg = nv + 1, nlevel2;
+				for (Ti k = nv - 1; k >= 0 && level[queue[k]] == nlevel - 1; k--)
+				{
+					Ti d = degree(queue[k]);
+					if (d < min_deg) { min_deg = d; new_root = queue[k]; }
+				}
+				bfs(new_root, nlevel2);
+				if (nlevel2 <= nlevel)
+				{
+					bfs(root, nlevel);
+					break;
+				}
+				root = new_root; nlevel = nlevel2;
+			}
+
+			if (nlevel < 3)
+			{	// the graph is too dense to split
+				order_leaf(nodes, offset);
+				return;
+			}
+
+			// pick the level minimizing |sep| / min(|part 1|, |part 2|)
+			std::vector<Ti> level_size(nlevel, 0);
+			for (Ti v : nodes)
+				level_size[level[v]]++;
+
+			Ti best = -1; double best_cost = 0.0; Ti below = level_size[0];
+			for (Ti l = 1; l < nlevel - 1; l++)
+			{
+				Ti above = nv - below - level_size[l];
+				double cost = double(level_size[l]) / double(std::min(below, above));
+				if (best == -1 || cost < best_cost)
+				{
+					best = l; best_cost = cost;
+				}
+				below += level_size[l];
+			}
+
+			// nodes in the separator level without neighbors above can move to part 1
+			std::vector<Ti> part1, part2, sep;
+			for (Ti v : nodes)
+			{
+				Ti l = level[v];
+				if (l < best)
+					part1.push_back(v);
+				else if (l > best)
+					part2.push_back(v);
+				else
+				{
+					bool touch = false;
+					for (Ti p = Cp[v]; p < Cp[v + 1] && !touch; p++)
+						touch = (mark[Ci[p]] == my_stamp && level[Ci[p]] == best + 1);
+
+					if (touch)
+						sep.push_back(v);
+					else
+						part1.push_back(v);
+				}
+			}
+
+			std::copy(sep.begin(), sep.end(), perm + offset + part1.size() + part2.size());
+			order(part1, offset);
+			order(part2, offset + Ti(part1.size()));
+		}
+	};
+
+	// Input: A with symmetric sparsity pattern (the values and the diagonal are ignored)
+	// Output: perm such that A(perm, perm) has a sparse cholesky factor and a balanced elimination tree
+	template <typename Tx, typename Ti>
+	UniquePtr<Ti> nested_dissection(const SparseMatrix<Tx, Ti>& A, Ti leaf_size = 256)
+	{
+		pcs_assert(A.initialized(), "nested_dissection: bad inputs.");
+		pcs_assert(A.n == A.m, "nested_dissection: dimensions mismatch.");
+
+		Ti n = A.n, * Ap = A.p.get(), * Ai = A.i.get();
+		UniquePtr<Ti> perm(new Ti[size_t(n) + 1]);
+
+		// drop the diagonal
+		Ti* Cp = new Ti[size_t(n) + 1];
+		Ti* Ci = new Ti[A.nnz() + 1];
+		Ti cnz = 0;
+		for (Ti j = 0; j < n; j++)
+		{
+			Cp[j] = cnz;
+			for (Ti p = Ap[j]; p < Ap[j + 1]; p++)
+				if (Ai[p] != j) Ci[cnz++] = Ai[p];
+		}
+		Cp[n] = cnz;
+
+		NestedDissection<Ti> nd;
+		nd.n = n; nd.Cp = Cp; nd.Ci = Ci; nd.perm = perm.get(); nd.leaf_size = leaf_size;
+		nd.mark.assign(n, -1);
+		nd.level.assign(n, 0);
+		nd.queue.resize(n);
+
+		std::vector<Ti> nodes(n);
+		for (Ti j = 0; j < n; j++)
+			nodes[j] = j;
+		if (n > 0)
+			nd.order(nodes, 0);
+
+		delete[] Ci;
+		delete[] Cp;
+		return perm;
+	}
+
+	// Output: B = A(perm, :) where pinv is the inverse of perm
+	template <typename Tx, typename Ti>
+	SparseMatrix<Tx, Ti> permute_rows(const SparseMatrix<Tx, Ti>& A, const Ti* pinv)
+	{
+		pcs_assert(A.initialized(), "permute_rows: bad inputs.");
+
+		Ti m = A.m, n = A.n, nz = A.nnz();
+		Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx* Ax = A.x.get();
+		SparseMatrix<Tx, Ti> B(m, n, nz);
+		Ti* Bp = B.p.get(), * Bi = B.i.get(); Tx* Bx = B.x.get();
+
+		// bucket the entries by their new row, then write them back col by col
+		Ti* Rp = new Ti[size_t(m) + 1]();
+		Ti* Rj = new Ti[nz + 1];
+		Ti* Rs = new Ti[nz + 1];
+		for (Ti s = 0; s < nz; s++)
+			Rp[pinv[Ai[s]] + 1]++;
+		for (Ti i = 0; i < m; i++)
+			Rp[i + 1] += Rp[i];
+		for (Ti j = 0; j < n; j++)
+		{
+			for (Ti s = Ap[j]; s < Ap[j + 1]; s++)
+			{
+				Ti q = Rp[pinv[Ai[s]]]++;
+				Rj[q] = j; Rs[q] = s;
+			}
+		}
+
+		Ti* c = new Ti[size_t(n) + 1];
+		for (Ti j = 0; j <= n; j++)
+			Bp[j] = c[j] = Ap[j];
+		for (Ti i = 0, q = 0; i < m; i++)
+		{
+			for (; q < Rp[i]; q++)
+			{
+				Ti t = c[Rj[q]]++;
+				Bi[t] = i;
+				if (Bx) Bx[t] = Ax[Rs[q]];
+			}
+		}
+
+		delete[] c;
+		delete[] Rs;
+		delete[] Rj;
+		delete[] Rp;
+		return B;
+	}
+}
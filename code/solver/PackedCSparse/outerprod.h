@@ -34,7 +34,16 @@ namespace PackedCSparse {
 		if (!o.initialized())
 			o.initialize(A, S, B);
 
-		Ti Sn = S.n, Sm = S.m, An = A.n;
+		std::fill(o.s_mark.get(), o.s_mark.get() + S.m, Ti(-1));
+		std::fill(o.x.get(), o.x.get() + A.n, Tx(0.0));
+		outerprod(o, A, S, B, Ti(0), S.n);
+	}
+
+	// Add the terms of the columns j0, ..., j1-1 of S to x. o must be initialized, with s_mark = -1 and x = 0
+	// before the first call. Calls on ranges with disjoint rows of A and S can run in parallel.
+	template<typename Tx, typename Ti, typename Tx2>
+	void outerprod(OuterprodOutput<Tx, Ti>& o, const SparseMatrix<Tx2, Ti>& A, const SparseMatrix<Tx, Ti>& S, const SparseMatrix<Tx2, Ti>& B, Ti j0, Ti j1)
+	{
 		Ti* Ap = A.p.get(), * Ai = A.i.get(); Tx2* Ax = A.x.get();
 		Ti* Bp = B.p.get(), * Bi = B.i.get(); Tx2* Bx = B.x.get();
 		Ti* Sp = S.p.get(), * Si = S.i.get(); Tx* Sx = S.x.get();
@@ -42,10 +51,7 @@ namespace PackedCSparse {
 		Ti* s_mark = o.s_mark.get();
 		Tx* x = o.x.get();
 
-		std::fill(s_mark, s_mark + Sm, Ti(-1));
-		std::fill(x, x + An, Tx(0.0));
-
-		for (Ti j = 0; j < Sn; j++)
+		for (Ti j = j0; j < j1; j++)
 		{
 			for (Ti p = Sp[j]; p < Sp[j + 1]; p++)
 			{
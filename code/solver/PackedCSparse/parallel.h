@@ -0,0 +1,189 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// A small work-stealing thread pool.
+// run(tasks) distributes the tasks round robin to per-thread queues. Each thread pops from the
+// front of its own queue and steals from the back of the other queues when it runs out of work.
+// The calling thread works as thread 0, so a pool of size 1 runs everything inline.
+// The workers run the tasks with the floating point mode (MXCSR) of the calling thread.
+// BlockRanges runs a loop over independent ranges of columns (e.g. the diagonal blocks of L) on the pool.
+
+namespace PackedCSparse {
+	class ThreadPool
+	{
+	public:
+		using Task = std::function<void(size_t)>; // the argument is the id of the thread running the task
+
+		explicit ThreadPool(size_t nthreads) : queues(nthreads > 0 ? nthreads : 1)
+		{
+			for (size_t tid = 1; tid < queues.size(); tid++)
+				workers.emplace_back([this, tid]() { worker(tid); });
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m);
+				stop = true;
+			}
+			cv.notify_all();
+			for (auto& t : workers)
+				t.join();
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		size_t size() const
+		{
+			return queues.size();
+		}
+
+		// Run all tasks and wait until they finish.
+		void run(const std::vector<Task>& tasks_)
+		{
+			if (tasks_.empty()) return;
+			if (queues.size() == 1)
+			{
+				for (auto& t : tasks_) t(0);
+				return;
+			}
+
+			tasks = &tasks_;
+			remaining = tasks_.size();
+			for (size_t i = 0; i < tasks_.size(); i++)
+			{
+				Queue& q = queues[i % queues.size()];
+				std::lock_guard<std::mutex> lock(q.m);
+				q.q.push_back(i);
+			}
+
+			{	// csr is read by the workers under the lock, a worker of the previous batch may still be running
+				std::lock_guard<std::mutex> lock(m);
+#ifdef __SSE__
+				csr = _mm_getcsr();
+#endif
+				batch++;
+			}
+			cv.notify_all();
+
+			work(0);
+
+			std::unique_lock<std::mutex> lock(m);
+			done.wait(lock, [this]() { return remaining == 0; });
+		}
+
+	private:
+		struct Queue
+		{
+			std::mutex m;
+			std::deque<size_t> q;
+		};
+
+		std::vector<Queue> queues;
+		std::vector<std::thread> workers;
+		const std::vector<Task>* tasks = nullptr;
+		std::atomic<size_t> remaining{ 0 };
+
+		std::mutex m;
+		std::condition_variable cv, done;
+		size_t batch = 0;
+		bool stop = false;
+		unsigned int csr = 0;
+
+		bool pop(size_t tid, size_t& task)
+		{
+			size_t nq = queues.size();
+			for (size_t s = 0; s < nq; s++)
+			{
+				Queue& q = queues[(tid + s) % nq];
+				std::lock_guard<std::mutex> lock(q.m);
+				if (q.q.empty()) continue;
+
+				if (s == 0)
+				{	// own queue
+					task = q.q.front();
+					q.q.pop_front();
+				}
+				else
+				{	// steal
+					task = q.q.back();
+					q.q.pop_back();
+				}
+				return true;
+			}
+			return false;
+		}
+
+		void work(size_t tid)
+		{
+			size_t task;
+			while (pop(tid, task))
+			{
+				(*tasks)[task](tid);
+				if (--remaining == 0)
+				{
+					std::lock_guard<std::mutex> lock(m);
+					done.notify_all();
+				}
+			}
+		}
+
+		void worker(size_t tid)
+		{
+			size_t seen = 0;
+			unsigned int batch_csr = 0;
+			while (true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(m);
+					cv.wait(lock, [&]() { return stop || batch != seen; });
+					if (stop) return;
+					seen = batch;
+					batch_csr = csr;
+				}
+#ifdef __SSE__
+				_mm_setcsr(batch_csr);
+#endif
+				work(tid);
+			}
+		}
+	};
+
+	// Consecutive ranges of columns that do not depend on each other, e.g. groups of diagonal blocks of L.
+	// run calls f(j0, j1, tid) for each range [j0, j1), in parallel if there is a pool with more than one thread.
+	template <typename Ti>
+	struct BlockRanges
+	{
+		ThreadPool* pool = nullptr;
+		std::vector<Ti> start;	// the range t is the columns start[t], ..., start[t+1]-1
+
+		// one range with all n columns
+		explicit BlockRanges(Ti n) : start{ Ti(0), n } {}
+
+		template <typename F>
+		void run(F f) const
+		{
+			size_t nt = start.size() - 1;
+			if (!pool || pool->size() <= 1 || nt <= 1)
+			{
+				f(start.front(), start.back(), size_t(0));
+				return;
+			}
+
+			std::vector<ThreadPool::Task> tasks;
+			for (size_t t = 0; t < nt; t++)
+				tasks.push_back([this, &f, t](size_t tid) { f(start[t], start[t + 1], tid); });
+			pool->run(tasks);
+		}
+	};
+}
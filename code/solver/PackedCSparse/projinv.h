@@ -1,5 +1,6 @@
 #pragma once
 #include "SparseMatrix.h"
+#include "scratch.h"
 
 // Problem:
 // Compute inv(L L') restricted on L
@@ -15,17 +16,21 @@ namespace PackedCSparse {
 		TransposeOutput<bool, Ti> Lt;	// sparsity pattern of the Lt
 		UniqueAlignedPtr<Tx> w;			// the row of L we are computing
 		UniquePtr<Ti> c;				// c[i] = index the last nonzero on column i in the current L
+		Ti dense_start = -1;			// the columns dense_start, ..., n-1 of L are dense (see CholOutput::dense_start, -1 = none)
+		std::string scratch_dir;		// out of core: if not empty, x is in a scratch file in this directory (see scratch.h)
 
 		void initialize(const SparseMatrix<Tx, Ti>& L)
 		{
 			pcs_assert(L.initialized(), "chol: bad inputs.");
 			pcs_assert(L.n == L.m, "chol: dimensions mismatch.");
 
-			// Copy the sparsity of L
-			SparseMatrix<Tx, Ti>::operator=(std::move(L.clone()));
+			// Share the sparsity of L, every entry of x is computed by projinv
+			Ti n = L.n, nz = L.nnz();
+			this->m = n; this->n = n;
+			this->p = L.p; this->i = L.i;
+			this->x.reset(pcs_values_new<Tx>(nz > 0 ? nz : 1, scratch_dir));
 
 			// allocate workspaces
-			Ti n = L.n;
 			w.reset(pcs_aligned_new<Tx>(n));
 			c.reset(new Ti[n]);
 			Lt = transpose<Tx, Ti, bool>(L);
@@ -38,23 +43,52 @@ namespace PackedCSparse {
 		if (!o.initialized())
 			o.initialize(L);
 
+		projinv(o, L, Ti(0), L.n);
+	}
+
+	// Compute the rows and columns k0, ..., k1-1 of inv(L L')|_L, which must be a union of diagonal blocks of L.
+	// o must be initialized.
+	template <typename Tx, typename Ti>
+	void projinv(ProjinvOutput<Tx, Ti>& o, const SparseMatrix<Tx, Ti>& L, Ti k0, Ti k1)
+	{
 		Tx* Sx = o.x.get(); Ti n = o.n;
 		Ti* Li = L.i.get(), * Lp = L.p.get(); Tx* Lv = L.x.get();
 		Ti* Lti = o.Lt.i.get(), * Ltp = o.Lt.p.get();
 		Tx* w = o.w.get();
 		Ti* c = o.c.get();
+		Ti t = o.dense_start < 0 ? n : o.dense_start;
 		Tx T0 = Tx(0), T1 = Tx(1);
 
-		for (Ti k = 0; k < n; k++)
+		for (Ti k = k0; k < k1; k++)
 			c[k] = Lp[k + 1] - 1;
 
-		for (Ti k = n - 1; k != -1; k--)
+		for (Ti k = k1 - 1; k >= k0; k--)
 		{
 			for (Ti p = Lp[k] + 1; p < Lp[k + 1]; p++)
 				w[Li[p]] = Sx[p];
 
 			Tx sum = T1 / Lv[Lp[k]];
-			for (Ti p = Ltp[k + 1] - 1; p != Ltp[k] - 1; p--)
+			Ti p_end = Ltp[k + 1] - 1;
+
+			// the row k in the dense trailing block, i.e. the columns k, k-1, ..., t
+			if (k >= t)
+			{
+				for (Ti i = k; i >= t; i--)
+				{
+					Tx* Lvi = Lv + Lp[i] - i;
+					for (Ti q = i + 1; q < n; q++)
+						fnmadd(sum, Lvi[q], w[q]);
+
+					sum = sum / Lvi[i];
+					w[i] = sum;
+					Sx[c[i]] = sum;
+					c[i]--;
+					sum = T0;
+				}
+				p_end -= k - t + 1;
+			}
+
+			for (Ti p = p_end; p != Ltp[k] - 1; p--)
 			{
 				Ti i = Lti[p], Lpi = Lp[i];
 
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "SparseMatrix.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Problem:
+// Keep the numeric arrays of the factors (e.g. the values of L) out of RAM when they do not fit
+
+// Algorithm:
+// The array lives in a shared memory mapping of a scratch file that is deleted as soon as it is opened,
+// so the kernel writes its pages back to the file under memory pressure instead of failing the allocation.
+// L is stored column by column and the kernels visit it in elimination order, so chol and lsolve sweep
+// the file forward and ltsolve and projinv sweep it backward, which the page cache streams well.
+// The array is an ordinary UniqueAlignedPtr, its AlignedDeleter unmaps it.
+
+namespace PackedCSparse {
+#ifdef _WIN32
+	static void pcs_scratch_release(void* block, size_t)
+	{
+		UnmapViewOfFile(block);
+	}
+#else
+	static void pcs_scratch_release(void* block, size_t bytes)
+	{
+		munmap(block, bytes);
+	}
+#endif
+
+	// An array of size entries in a new scratch file in the directory dir. The entries are zero.
+	template <typename T>
+	T* pcs_scratch_new(size_t size, const std::string& dir)
+	{
+		size_t bytes = size * sizeof(T) + 63 + sizeof(AlignedHeader);
+		void* block = nullptr;
+#ifdef _WIN32
+		char path[MAX_PATH];
+		pcs_assert(GetTempFileNameA(dir.c_str(), "pcs", 0, path) != 0, "scratch: cannot create a file in the directory.");
+		HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		pcs_assert(file != INVALID_HANDLE_VALUE, "scratch: cannot open the file.");
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(uint64_t(bytes) >> 32), DWORD(bytes), nullptr);
+		if (mapping)
+			block = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		if (mapping) CloseHandle(mapping); // the view keeps the mapping and the file alive
+		CloseHandle(file);
+		pcs_assert(block != nullptr, "scratch: cannot map the file.");
+#else
+		std::string name = dir + "/pcs_scratch_XXXXXX";
+		std::vector<char> path(name.begin(), name.end());
+		path.push_back('\0');
+		int fd = mkstemp(path.data());
+		pcs_assert(fd != -1, "scratch: cannot create a file in the directory.");
+		unlink(path.data());
+		if (ftruncate(fd, off_t(bytes)) == 0)
+		{
+			void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED) block = p;
+		}
+		close(fd); // the mapping keeps the file alive
+		pcs_assert(block != nullptr, "scratch: cannot map the file.");
+#endif
+		return pcs_aligned_init<T>(block, bytes, pcs_scratch_release);
+	}
+
+	// An array of size entries in a scratch file in dir, or in memory if dir is empty
+	template <typename T>
+	T* pcs_values_new(size_t size, const std::string& dir)
+	{
+		return dir.empty() ? pcs_aligned_new<T>(size) : pcs_scratch_new<T>(size, dir);
+	}
+}
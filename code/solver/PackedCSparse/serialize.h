@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "SparseMatrix.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Problem:
+// Store read only index arrays in a binary file and map them back without copying
+
+// Algorithm:
+// A structure describes its content once with a templated serialize(Archive&) that lists its scalars
+// and arrays in order. FileWriter writes them, FileReader maps the file and points the arrays into
+// the mapping, so loading costs O(1) and the pages are shared by all processes mapping the same file.
+// Every scalar takes 8 bytes and every array is its length (8 bytes) followed by the data padded to
+// 8 bytes. The file uses the native byte order and the size of the index type is checked on load.
+
+namespace PackedCSparse {
+	// A read only memory mapping of a whole file. It is unmapped when the last array pointing into it is freed.
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const char* path)
+		{
+#ifdef _WIN32
+			file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			pcs_assert(file != INVALID_HANDLE_VALUE, "MappedFile: cannot open the file.");
+			LARGE_INTEGER len;
+			GetFileSizeEx(file, &len);
+			size_ = size_t(len.QuadPart);
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+				data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!data_)
+			{
+				close();
+				pcs_assert(false, "MappedFile: cannot map the file.");
+			}
+#else
+			fd = open(path, O_RDONLY);
+			pcs_assert(fd != -1, "MappedFile: cannot open the file.");
+			struct stat st;
+			fstat(fd, &st);
+			size_ = size_t(st.st_size);
+			void* p = (size_ > 0) ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+			if (p == MAP_FAILED)
+			{
+				close();
+				pcs_assert(false, "MappedFile: cannot map the file.");
+			}
+			data_ = (const char*)p;
+#endif
+		}
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const char* data() const
+		{
+			return data_;
+		}
+
+		size_t size() const
+		{
+			return size_;
+		}
+
+		static bool exists(const char* path)
+		{
+			return std::ifstream(path, std::ios::binary).good();
+		}
+
+	private:
+		const char* data_ = nullptr;
+		size_t size_ = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+
+		void close()
+		{
+			if (data_) UnmapViewOfFile(data_);
+			if (mapping) CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+			data_ = nullptr; mapping = nullptr; file = INVALID_HANDLE_VALUE;
+		}
+#else
+		int fd = -1;
+
+		void close()
+		{
+			if (data_) munmap((void*)data_, size_);
+			if (fd != -1) ::close(fd);
+			data_ = nullptr; fd = -1;
+		}
+#endif
+	};
+
+	class FileWriter
+	{
+	public:
+		FileWriter(const char* path, const char (&magic)[8], size_t index_size) : out(path, std::ios::binary | std::ios::trunc)
+		{
+			pcs_assert(out.good(), "FileWriter: cannot open the file.");
+			out.write(magic, 8);
+			uint64_t size = index_size;
+			scalar(size);
+		}
+
+		~FileWriter() noexcept(false)
+		{
+			out.flush();
+			pcs_assert(out.good(), "FileWriter: cannot write the file.");
+		}
+
+		template <typename T>
+		void scalar(T& v)
+		{
+			static_assert(sizeof(T) <= 8, "FileWriter: scalars take at most 8 bytes.");
+			char buf[8] = {};
+			memcpy(buf, &v, sizeof(T));
+			out.write(buf, 8);
+		}
+
+		// len is the number of entries of a (ignored if a is null)
+		template <typename T>
+		void array(SharedPtr<T>& a, size_t len)
+		{
+			uint64_t n = a ? len : 0;
+			scalar(n);
+			out.write((const char*)a.get(), n * sizeof(T));
+			char zeros[8] = {};
+			out.write(zeros, (8 - (n * sizeof(T)) % 8) % 8);
+		}
+
+	private:
+		std::ofstream out;
+	};
+
+	class FileReader
+	{
+	public:
+		FileReader(const char* path, const char (&magic)[8], size_t index_size) : file(std::make_shared<MappedFile>(path))
+		{
+			pcs_assert(file->size() >= 16 && memcmp(file->data(), magic, 8) == 0, "FileReader: wrong file format.");
+			pos = 8;
+			uint64_t size;
+			scalar(size);
+			pcs_assert(size == index_size, "FileReader: the file uses another index type.");
+		}
+
+		template <typename T>
+		void scalar(T& v)
+		{
+			pcs_assert(pos + 8 <= file->size(), "FileReader: the file is truncated.");
+			memcpy(&v, file->data() + pos, sizeof(T));
+			pos += 8;
+		}
+
+		// a points into the mapping and keeps it alive (null if the stored array is empty)
+		template <typename T>
+		void array(SharedPtr<T>& a, size_t)
+		{
+			uint64_t n;
+			scalar(n);
+			size_t bytes = size_t(n) * sizeof(T);
+			pcs_assert(n <= file->size() && pos + bytes <= file->size(), "FileReader: the file is truncated.");
+			if (n > 0)
+				a = SharedPtr<T>(file, (T*)(file->data() + pos));
+			else
+				a.reset();
+			pos += bytes + (8 - bytes % 8) % 8;
+		}
+
+	private:
+		std::shared_ptr<MappedFile> file;
+		size_t pos = 0;
+	};
+}
@@ -11,7 +11,7 @@ namespace PackedCSparse {
 	template <typename Tx, typename Ti>
 	struct TransposeOutput : SparseMatrix<Tx, Ti>
 	{
-		UniquePtr<Ti> forward;
+		SharedPtr<Ti> forward;		// the entry s of A is the entry forward[s] of A', can be shared with other matrices
 
 		template<typename Tx2>
 		void initialize(const SparseMatrix<Tx2, Ti>& A)
@@ -0,0 +1,328 @@
+#pragma once
+#include <queue>
+#include <vector>
+#include "SparseMatrix.h"
+#include "parallel.h"
+
+// Problem:
+// Solve L out = x and L' out = x with several threads
+
+// Algorithm:
+// The rows of the column j of L are on the path from j to the root of the elimination tree.
+// We split the tree into independent subtrees and the top part above them, as chol_supernodal does.
+// lsolve: the subtrees run in parallel and each column updates only the rows of its own subtree.
+//		The top rows then gather the entries of the subtree columns (in parallel over the rows)
+//		and the top columns run in order.
+// ltsolve: the top columns run first in reverse order, then the subtrees in parallel.
+//		Each column gathers from its rows, which are in its own subtree or in the top part.
+// A factor with supernodes is split such that every supernode is in one subtree or in the top part,
+// and the columns of a supernode are solved together with the dense kernels of lsolve_supernodal.
+// The schedule depends only on the pattern of L and the number of threads (see CholOutput::solve_tasks).
+
+namespace PackedCSparse {
+	template <typename Ti>
+	struct SolveSchedule
+	{
+		ThreadPool* pool = nullptr;		// the pool the schedule is built for
+		size_t nthreads = 0;
+		Ti ntasks = 0;
+		Ti dense_start = 0;				// the columns dense_start, ..., n-1 are dense (see CholOutput::dense_start), they are in the top part
+		SharedPtr<Ti> task_p;			// task_p[t], ..., task_p[t+1]-1 index the columns of the t-th subtree in task_j,
+		SharedPtr<Ti> task_j;			// the last one (t = ntasks) is the top part. The columns of a task are increasing.
+		SharedPtr<Ti> split;			// the rows Li[split[j]], ... of a subtree column j are in the top part
+		SharedPtr<Ti> top_p;			// the r-th top row has the entries Lx[top_s[e]] in the subtree columns top_j[e]
+		SharedPtr<Ti> top_s, top_j;		// for e = top_p[r], ..., top_p[r+1]-1
+		BlockRanges<Ti> tasks{ 0 };		// one range per subtree
+		BlockRanges<Ti> top_rows{ 0 };	// groups of top rows with about the same number of entries
+		Ti nsuper = 0;					// the supernodes of L (see CholOutput::super), 0 if it has none
+		SharedPtr<Ti> super;
+		SharedPtr<Ti> col_super;		// the supernode of the column j < dense_start
+
+		// Repeatedly move the root of the most expensive subtree to the top part until every subtree
+		// costs at most 1/(2 nthreads) of nnz(L). The cost of a column is its number of entries.
+		// A root moves with the columns of its supernode below it, so the supernodes are not split.
+		template <typename Tx>
+		void initialize(const SparseMatrix<Tx, Ti>& L, const Ti* parent, Ti dense_start_, ThreadPool* pool_,
+			Ti nsuper_ = 0, const SharedPtr<Ti>& super_ = SharedPtr<Ti>())
+		{
+			Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get();
+			pool = pool_;
+			nthreads = pool->size();
+			dense_start = dense_start_;
+			nsuper = nsuper_;
+			super = super_;
+			col_super.reset();
+			if (nsuper > 0)
+			{
+				col_super.reset(new Ti[n > 0 ? n : 1]);
+				for (Ti J = 0; J < nsuper; J++)
+					for (Ti j = super[J]; j < super[J + 1]; j++)
+						col_super[j] = J;
+			}
+
+			std::vector<Ti> head(n, -1), next(n, -1), owner(n, -1);
+			std::vector<double> cost(n, 0.0);
+			auto sparent = [parent, this](Ti j) {
+				Ti p = parent[j];
+				return (p == -1 || p >= dense_start) ? Ti(-1) : p;
+			};
+			for (Ti j = 0; j < dense_start; j++)
+				cost[j] += double(Lp[j + 1] - Lp[j]);
+			for (Ti j = 0; j < dense_start; j++)
+				if (sparent(j) != -1) cost[sparent(j)] += cost[j];
+			for (Ti j = dense_start - 1; j >= 0; j--)
+			{
+				if (sparent(j) == -1) continue;
+				next[j] = head[sparent(j)];
+				head[sparent(j)] = j;
+			}
+
+			using Item = std::pair<double, Ti>;
+			std::priority_queue<Item> heap;
+			std::vector<bool> is_top(n, false);
+			for (Ti j = 0; j < dense_start; j++)
+				if (sparent(j) == -1) heap.push(Item(cost[j], j));
+			for (Ti j = dense_start; j < n; j++)
+				is_top[j] = true;
+
+			double limit = double(L.nnz()) / double(2 * nthreads);
+			while (!heap.empty() && heap.top().first > limit)
+			{
+				// a root is the last column of its supernode, whose columns are a chain j0, ..., j
+				Ti j = heap.top().second, j0 = (nsuper > 0) ? super[col_super[j]] : j;
+				heap.pop();
+				for (Ti jj = j0; jj <= j; jj++)
+				{
+					is_top[jj] = true;
+					for (Ti c = head[jj]; c != -1; c = next[c])
+						if (c < j0) heap.push(Item(cost[c], c));
+				}
+			}
+
+			// the subtrees are listed from the most expensive one
+			ntasks = Ti(heap.size());
+			for (Ti t = 0; t < ntasks; t++)
+			{
+				owner[heap.top().second] = t;
+				heap.pop();
+			}
+			for (Ti j = n - 1; j >= 0; j--)
+			{
+				if (is_top[j])
+					owner[j] = ntasks;
+				else if (owner[j] == -1)
+					owner[j] = owner[sparent(j)];
+			}
+
+			task_p.reset(new Ti[size_t(ntasks) + 2]());
+			task_j.reset(new Ti[n]);
+			for (Ti j = 0; j < n; j++)
+				task_p[owner[j] + 1]++;
+			for (Ti t = 0; t <= ntasks; t++)
+				task_p[t + 1] += task_p[t];
+			std::vector<Ti> c(task_p.get(), task_p.get() + ntasks + 1);
+			for (Ti j = 0; j < n; j++)
+				task_j[c[owner[j]]++] = j;
+
+			// the rows of a column are increasing and the top rows are the ancestors of its subtree root
+			Ti ntop = task_p[ntasks + 1] - task_p[ntasks], * top = task_j.get() + task_p[ntasks];
+			std::vector<Ti> top_pos(n, -1);
+			for (Ti r = 0; r < ntop; r++)
+				top_pos[top[r]] = r;
+
+			split.reset(new Ti[n]);
+			top_p.reset(new Ti[size_t(ntop) + 1]());
+			for (Ti j = 0; j < n; j++)
+			{
+				if (is_top[j]) continue;
+				Ti p = Lp[j] + 1;
+				while (p < Lp[j + 1] && top_pos[Li[p]] == -1) p++;
+				split[j] = p;
+				for (; p < Lp[j + 1]; p++)
+					top_p[top_pos[Li[p]] + 1]++;
+			}
+			for (Ti r = 0; r < ntop; r++)
+				top_p[r + 1] += top_p[r];
+
+			Ti ne = top_p[ntop];
+			top_s.reset(new Ti[ne > 0 ? ne : 1]);
+			top_j.reset(new Ti[ne > 0 ? ne : 1]);
+			std::vector<Ti> e(top_p.get(), top_p.get() + ntop);
+			for (Ti j = 0; j < n; j++)
+			{
+				if (is_top[j]) continue;
+				for (Ti p = split[j]; p < Lp[j + 1]; p++)
+				{
+					Ti q = e[top_pos[Li[p]]]++;
+					top_s[q] = p;
+					top_j[q] = j;
+				}
+			}
+
+			tasks = BlockRanges<Ti>(ntasks);
+			tasks.pool = pool;
+			tasks.start.resize(size_t(ntasks) + 1);
+			for (Ti t = 0; t <= ntasks; t++)
+				tasks.start[t] = t;
+
+			top_rows = BlockRanges<Ti>(ntop);
+			top_rows.pool = pool;
+			top_rows.start.pop_back();
+			double top_limit = double(ne) / double(4 * nthreads);
+			for (Ti r = 1; r < ntop; r++)
+			{
+				if (double(top_p[r] - top_p[top_rows.start.back()]) >= top_limit)
+					top_rows.start.push_back(r);
+			}
+			top_rows.start.push_back(ntop);
+		}
+	};
+
+	// Solve L out = x with the schedule S of L (see SolveSchedule). out can be x.
+	template <typename Tx, typename Ti, typename Tx2>
+	void lsolve(const SparseMatrix<Tx, Ti>& L, const SolveSchedule<Ti>& S, Tx2* x, Tx2* out)
+	{
+		Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
+		Ti* task_p = S.task_p.get(), * task_j = S.task_j.get(), * split = S.split.get();
+		Ti* top_p = S.top_p.get(), * top_s = S.top_s.get(), * top_j = S.top_j.get();
+		Ti ntop = task_p[S.ntasks + 1] - task_p[S.ntasks], * top = task_j + task_p[S.ntasks];
+
+		Ti* super = S.super.get(), * col_super = S.col_super.get();
+
+		if (x != out) std::copy(x, x + n, out);
+
+		// the subtrees update the rows of their own subtree
+		S.tasks.run([=, &L](Ti t0, Ti t1, size_t) {
+			for (Ti t = t0; t < t1; t++)
+			{
+				for (Ti q = task_p[t]; q < task_p[t + 1]; q++)
+				{
+					Ti j = task_j[q];
+					if (col_super)
+					{	// the columns of the supernode are next in the subtree and share split
+						Ti ns = super[col_super[j] + 1] - j;
+						lsolve_supernode(L, j, ns, split[j] - Lp[j], out);
+						q += ns - 1;
+						continue;
+					}
+
+					Tx2 out_j = out[j] / Lx[Lp[j]];
+					out[j] = out_j;
+
+					for (Ti p = Lp[j] + 1; p < split[j]; p++)
+						fnmadd(out[Li[p]], out_j, Lx[p]);
+				}
+			}
+		});
+
+		// the top rows gather the rest of the subtree columns
+		S.top_rows.run([=](Ti r0, Ti r1, size_t) {
+			for (Ti r = r0; r < r1; r++)
+			{
+				Tx2 out_i = out[top[r]];
+				for (Ti e = top_p[r]; e < top_p[r + 1]; e++)
+					fnmadd(out_i, out[top_j[e]], Lx[top_s[e]]);
+				out[top[r]] = out_i;
+			}
+		});
+
+		// the top columns in order, the dense trailing block last
+		Ti ds = S.dense_start;
+		for (Ti r = 0; r < ntop && top[r] < ds; r++)
+		{
+			Ti j = top[r];
+			if (col_super)
+			{
+				Ti ns = super[col_super[j] + 1] - j;
+				lsolve_supernode(L, j, ns, Lp[j + 1] - Lp[j], out);
+				r += ns - 1;
+				continue;
+			}
+
+			Tx2 out_j = out[j] / Lx[Lp[j]];
+			out[j] = out_j;
+
+			for (Ti p = Lp[j] + 1; p < Lp[j + 1]; p++)
+				fnmadd(out[Li[p]], out_j, Lx[p]);
+		}
+
+		for (Ti j = ds; j < n; j++)
+		{
+			Tx* Lj = Lx + Lp[j] - j;
+			Tx2 out_j = out[j] / Lj[j];
+			out[j] = out_j;
+
+			for (Ti i = j + 1; i < n; i++)
+				fnmadd(out[i], out_j, Lj[i]);
+		}
+	}
+
+	// Solve L' out = x with the schedule S of L (see SolveSchedule). out can be x.
+	template <typename Tx, typename Ti, typename Tx2>
+	void ltsolve(const SparseMatrix<Tx, Ti>& L, const SolveSchedule<Ti>& S, Tx2* x, Tx2* out)
+	{
+		Ti n = L.n, * Lp = L.p.get(), * Li = L.i.get(); Tx* Lx = L.x.get();
+		Ti* task_p = S.task_p.get(), * task_j = S.task_j.get();
+		Ti ntop = task_p[S.ntasks + 1] - task_p[S.ntasks], * top = task_j + task_p[S.ntasks];
+		Ti* super = S.super.get(), * col_super = S.col_super.get();
+
+		if (x != out) std::copy(x, x + n, out);
+
+		// the top columns in reverse order, the dense trailing block first
+		Ti ds = S.dense_start;
+		for (Ti j = n - 1; j >= ds; j--)
+		{
+			Tx* Lj = Lx + Lp[j] - j;
+			Tx2 out_j = out[j];
+
+			for (Ti i = j + 1; i < n; i++)
+				fnmadd(out_j, out[i], Lj[i]);
+
+			out[j] = out_j / Tx2(Lj[j]);
+		}
+
+		for (Ti r = Ti(std::lower_bound(top, top + ntop, ds) - top) - 1; r >= 0; r--)
+		{
+			Ti j = top[r];
+			if (col_super)
+			{	// j is the last column of its supernode
+				Ti f = super[col_super[j]];
+				ltsolve_supernode(L, f, j + 1 - f, out);
+				r -= j - f;
+				continue;
+			}
+
+			Tx2 out_j = out[j];
+
+			for (Ti p = Lp[j] + 1; p < Lp[j + 1]; p++)
+				fnmadd(out_j, out[Li[p]], Lx[p]);
+
+			out[j] = out_j / Tx2(Lx[Lp[j]]);
+		}
+
+		// the subtrees read the rows of their own subtree and the top rows
+		S.tasks.run([=, &L](Ti t0, Ti t1, size_t) {
+			for (Ti t = t0; t < t1; t++)
+			{
+				for (Ti q = task_p[t + 1] - 1; q >= task_p[t]; q--)
+				{
+					Ti j = task_j[q];
+					if (col_super)
+					{
+						Ti f = super[col_super[j]];
+						ltsolve_supernode(L, f, j + 1 - f, out);
+						q -= j - f;
+						continue;
+					}
+
+					Tx2 out_j = out[j];
+
+					for (Ti p = Lp[j] + 1; p < Lp[j + 1]; p++)
+						fnmadd(out_j, out[Li[p]], Lx[p]);
+
+					out[j] = out_j / Tx2(Lx[Lp[j]]);
+				}
+			}
+		});
+	}
+}
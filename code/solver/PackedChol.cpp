@@ -1,4 +1,5 @@
 #include <cstring>
+#include <unordered_map>
 #include "mex_utils.h"
 #include "PackedCSparse/PackedChol.h"
 
@@ -14,6 +15,51 @@ using CholObj = PackedChol<chol_k, Index>;
 using Matrix = SparseMatrix<double, Index>;
 using Tx2 = FloatArray<double, chol_k>;
 
+// The symbolic analysis of the solvers alive, keyed by pattern_hash. The solvers hold the references,
+// so an entry expires when the last solver of its pattern is deleted.
+std::unordered_map<uint64_t, std::weak_ptr<PackedCholSymbolic<Index>>> symbolic_cache;
+
+// FNV-1a hash of the pattern of A and the ordering
+uint64_t pattern_hash(const Matrix& A, Ordering ordering, bool postorder)
+{
+	uint64_t h = 14695981039346656037ull;
+	auto add = [&h](uint64_t v)
+	{
+		for (int b = 0; b < 64; b += 8)
+		{
+			h ^= (v >> b) & 0xff;
+			h *= 1099511628211ull;
+		}
+	};
+	add(uint64_t(A.m)); add(uint64_t(A.n)); add(uint64_t(ordering)); add(uint64_t(postorder));
+	for (Index j = 0; j <= A.n; j++)
+		add(uint64_t(A.p[j]));
+	for (Index s = 0; s < A.nnz(); s++)
+		add(uint64_t(A.i[s]));
+	return h;
+}
+
+// output one value per lane
+void outputLanes(const double* v)
+{
+	if (SIMD_LEN == 0)
+		env::outputScalar<double>(v[0]);
+	else
+	{
+		double* out = env::outputArray<double>(SIMD_LEN, 1);
+		for (size_t i = 0; i < SIMD_LEN; i++)
+			out[i] = v[i];
+	}
+}
+
+void outputLanes(const Tx2& v)
+{
+	double v_lanes[chol_k];
+	for (size_t i = 0; i < chol_k; i++)
+		v_lanes[i] = get(v, i);
+	outputLanes(v_lanes);
+}
+
 int main()
 {
 	size_t simd_len = SIMD_LEN;
@@ -22,10 +68,52 @@ int main()
 	if (!strcmp(cmd, "init"))
 	{
 		Matrix A = std::move(env::inputSparseArray<double>());
-		auto solver = new CholObj(A);
+		Ordering ordering = (Ordering)env::inputScalar<double>(0.0);
+		bool postorder = env::inputScalar<double>(0.0) != 0.0;
+		const char* path = env::inputString(nullptr); // file of the symbolic analysis (see saveSymbolic)
+
+		// reuse the symbolic analysis of a solver with the same pattern
+		uint64_t key = pattern_hash(A, ordering, postorder);
+		for (auto it = symbolic_cache.begin(); it != symbolic_cache.end();)
+			it = it->second.expired() ? symbolic_cache.erase(it) : std::next(it);
+
+		auto it = symbolic_cache.find(key);
+		std::shared_ptr<PackedCholSymbolic<Index>> symbolic;
+		if (it != symbolic_cache.end())
+			symbolic = it->second.lock();
+		if ((!symbolic || !symbolic->matches(A, ordering, postorder)) && path && MappedFile::exists(path))
+			symbolic = PackedCholSymbolic<Index>::load(path);
+
+		CholObj* solver;
+		if (symbolic && symbolic->matches(A, ordering, postorder))
+			solver = new CholObj(A, symbolic);
+		else
+		{
+			solver = new CholObj(A, ordering, postorder);
+			symbolic = solver->makeSymbolic(A, ordering, postorder);
+			if (path)
+			{	// the analysis of chol used by default and by the exact factor
+				solver->buildSymbolic(solver->L_exact.method, solver->L_exact.dense_ratio, solver->L_exact.dense_min);
+				symbolic->save(path);
+			}
+		}
+		symbolic_cache[key] = symbolic;
 		solver->setSeed(uid);
 		env::outputScalar<uint64_t>((uint64_t)solver);
 	}
+	else if (!strcmp(cmd, "analyze"))
+	{	// [nnzH nnzL flopsChol flopsProjinv flopsSolve bytesPerLane bytesIndex], uid is ignored
+		Matrix A = std::move(env::inputSparseArray<double>());
+		Ordering ordering = (Ordering)env::inputScalar<double>(0.0);
+		bool postorder = env::inputScalar<double>(0.0) != 0.0;
+		CholMethod method = (CholMethod)env::inputScalar<double>(double(CholMethod::LeftLooking));
+		CholObj solver(A, ordering, postorder);
+		solver.setCholMethod(method);
+		PackedCholAnalysis r = solver.analyze();
+		double* out = env::outputArray<double>(1, 7);
+		out[0] = r.nnzH; out[1] = r.nnzL; out[2] = r.flopsChol; out[3] = r.flopsProjinv;
+		out[4] = r.flopsSolve; out[5] = r.bytesPerLane; out[6] = r.bytesIndex;
+	}
 	else
 	{
 		CholObj* solver = (CholObj*)uid;
@@ -45,6 +133,34 @@ int main()
 			}
 			solver->solve((Tx2*)b, (Tx2*)out);
 		}
+		else if (!strcmp(cmd, "solveMany"))
+		{	// r right hand sides, m x r (or simd_len x m r with the lanes)
+			const double* b; double* out;
+			size_t r = size_t(-1);
+			if (SIMD_LEN == 0)
+			{
+				b = env::inputArray<double>(m, r);
+				out = env::outputArray<double>(m, r);
+			}
+			else
+			{
+				b = env::inputArray<double>(simd_len, r);
+				if (m > 0 && r % m != 0) throw "solveMany: the number of columns should be a multiple of m.";
+				out = env::outputArray<double>(simd_len, r);
+				r = (m > 0) ? r / m : 0;
+			}
+			solver->solveMany((Tx2*)b, (Tx2*)out, r);
+		}
+		else if (!strcmp(cmd, "solveSparse"))
+		{	// a sparse m x r, each column is the right hand side of all lanes, out is m x r (or simd_len x m r)
+			Matrix B = std::move(env::inputSparseArray<double>(m));
+			double* out;
+			if (SIMD_LEN == 0)
+				out = env::outputArray<double>(m, B.n);
+			else
+				out = env::outputArray<double>(simd_len, m * B.n);
+			solver->solveSparse(B, (Tx2*)out);
+		}
 		else if (!strcmp(cmd, "decompose"))
 		{
 			const double* w;
@@ -53,15 +169,27 @@ int main()
 			else
 				w = env::inputArray<double>(simd_len, n);
 			Tx2 ret = solver->decompose((Tx2*)w);
-			
+			outputLanes(ret);
+			if (env::nlhs > 1)
+				outputLanes(solver->perturbedPivots);
+		}
+		else if (!strcmp(cmd, "update"))
+		{
+			const double* w_old, * w_new;
 			if (SIMD_LEN == 0)
-				env::outputScalar<double>(get(ret, 0));
+			{
+				w_old = env::inputArray<double>(n);
+				w_new = env::inputArray<double>(n);
+			}
 			else
 			{
-				double* out = env::outputArray<double>(simd_len, 1);
-				for (size_t i = 0; i < SIMD_LEN; i++)
-					out[i] = get(ret, i);
+				w_old = env::inputArray<double>(simd_len, n);
+				w_new = env::inputArray<double>(simd_len, n);
 			}
+			Tx2 ret = solver->update((Tx2*)w_old, (Tx2*)w_new);
+			outputLanes(ret);
+			if (env::nlhs > 1)
+				outputLanes(solver->perturbedPivots);
 		}
 		else if (!strcmp(cmd, "leverageScoreComplement"))
 		{
@@ -80,14 +208,7 @@ int main()
 		else if (!strcmp(cmd, "logdet"))
 		{
             Tx2 ret = solver->logdet();
-			if (SIMD_LEN == 0)
-				env::outputScalar<double>(get(ret, 0));
-			else
-			{
-				double* out = env::outputArray<double>(simd_len, 1);
-				for (size_t i = 0; i < SIMD_LEN; i++)
-					out[i] = get(ret, i);
-			}
+			outputLanes(ret);
 		}
 		else if (!strcmp(cmd, "diagL"))
 		{
@@ -108,6 +229,42 @@ int main()
 		{
 			solver->accuracyThreshold = env::inputScalar<double>();
 		}
+		else if (!strcmp(cmd, "setPivotTolerance"))
+		{
+			solver->pivotTolerance = env::inputScalar<double>();
+		}
+		else if (!strcmp(cmd, "updateA"))
+		{	// new values of A with the same pattern
+			solver->updateA(env::inputSparseArray<double>());
+		}
+		else if (!strcmp(cmd, "setScratchDirectory"))
+		{	// '' keeps the factors in memory
+			solver->setScratchDirectory(env::inputString(""));
+		}
+		else if (!strcmp(cmd, "saveSymbolic"))
+		{	// includes the analysis of every kernel used so far and the kernel selected by the autotuning
+			solver->symbolic->save(env::inputString());
+		}
+		else if (!strcmp(cmd, "setThreads"))
+		{
+			solver->setThreads((size_t)env::inputScalar<double>());
+		}
+		else if (!strcmp(cmd, "setLaneGroups"))
+		{	// the threads factorize groups of lanes instead of subtrees
+			solver->setLaneGroups(env::inputScalar<double>() != 0.0);
+		}
+		else if (!strcmp(cmd, "setMixedPrecision"))
+		{
+			solver->setMixedPrecision(env::inputScalar<double>() != 0.0);
+		}
+		else if (!strcmp(cmd, "setFusedAssembly"))
+		{	// 0 stores H = A W A' and factors it
+			solver->setFusedAssembly(env::inputScalar<double>() != 0.0);
+		}
+		else if (!strcmp(cmd, "setCholMethod"))
+		{
+			solver->setCholMethod((CholMethod)env::inputScalar<double>());
+		}
 		else if (!strcmp(cmd, "getDecomposeCount"))
 		{
 			env::outputDoubleArray(solver->numExact.data(), chol_k + 1);
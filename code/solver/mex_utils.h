@@ -129,6 +129,14 @@ namespace MexEnvironment
         return mxArrayToString(pt);
     }
 
+    const char *inputString(const char *default_value)
+    {
+        const char *val = default_value;
+        if (rhs_id < nrhs)
+            val = inputString();
+        return val;
+    }
+
     //A better thing to do is to have a matrix "view" and output the view
     template<typename Tv = double, typename Ti = mexIdx>
     SparseMatrix<Tv, Ti> inputSparseArray(size_t mRequired = -1, size_t nRequired = -1)
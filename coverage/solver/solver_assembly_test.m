@@ -0,0 +1,30 @@
+function solver_assembly_test(file, method)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+
+%% stored lower triangle of H against the assembly inside chol
+uid = solver('init', uint64(1234), A);
+solver('setCholMethod', uid, method);
+solver('setFusedAssembly', uid, 0);
+solver('decompose', uid, w);
+
+uid2 = solver('init', uint64(1234), A);
+solver('setCholMethod', uid2, method);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A, w);
+
+%% the same for the doubledouble factors
+solver('setAccuracyTarget', uid, 0.0);
+solver('setAccuracyTarget', uid2, 0.0);
+solver('decompose', uid, w);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A, w);
+solver('delete', uid);
+solver('delete', uid2);
+end
@@ -0,0 +1,24 @@
+function solver_autotune_test(file)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+
+%% autotuning against the left looking kernel, during and after the 12 tuning calls
+uid = solver('init', uint64(1234), A);
+solver('setCholMethod', uid, 4);
+uid2 = solver('init', uint64(1234), A);
+solver('setCholMethod', uid2, 0);
+for it = 1:14
+    w = rand(4, size(A,2)) + 0.2;
+    solver('decompose', uid, w);
+    solver('decompose', uid2, w);
+    if any(it == [1 4 12 13 14])
+        solver_compare(solver, uid, uid2, A, w);
+    end
+end
+
+solver('delete', uid);
+solver('delete', uid2);
+end
@@ -0,0 +1,31 @@
+function solver_compare(solver, uid, uid2, A, w)
+% Compare the solver uid against the reference solver uid2, both decomposed with w,
+% and the last lane of uid against H = A diag(w(end,:)) A'.
+k = size(w, 1);
+H = A * diag(sparse(w(k,:))) * A';
+
+%% test L
+L = solver('L', uid, k - 1);
+assert(sum(abs(H - L * L'),'all') < 0.01)
+
+%% test solve
+b = randn(k, size(A,1));
+x = solver('solve', uid, b);
+x2 = solver('solve', uid2, b);
+assert(max(abs(x - x2), [], 'all') < 1e-8 * max(abs(x2), [], 'all'));
+x3 = H \ b(k,:)';
+assert(sum(abs(x(k,:)' - x3)) < 0.01);
+
+%% test logdet
+logdet = solver('logdet', uid);
+logdet2 = solver('logdet', uid2);
+assert(all(abs(logdet - logdet2) < 0.01));
+
+%% test lsc
+lsc = solver('leverageScoreComplement', uid, 0);
+lsc2 = solver('leverageScoreComplement', uid2, 0);
+assert(max(abs(lsc - lsc2), [], 'all') < 1e-6);
+corank1 = sum(lsc, 2);
+corank2 = size(A,2)-size(A,1);
+assert(all(abs(corank1 - corank2)<0.01));
+end
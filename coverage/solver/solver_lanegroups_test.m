@@ -0,0 +1,30 @@
+function solver_lanegroups_test(file, method)
+compile_solver(8);
+solver = str2func(MexSolver.solverName(8));
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(8, size(A,2)) + 0.2;
+
+%% two groups of 4 lanes factorized by separate threads against the default solver
+uid = solver('init', uint64(1234), A);
+solver('setCholMethod', uid, method);
+solver('setThreads', uid, 2);
+solver('setLaneGroups', uid, 1);
+solver('decompose', uid, w);
+
+uid2 = solver('init', uint64(1234), A);
+solver('setCholMethod', uid2, method);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A, w);
+
+%% the first group
+H = A * diag(sparse(w(1,:))) * A';
+L = solver('L', uid, 0);
+assert(sum(abs(H - L * L'),'all') < 0.01)
+
+solver('delete', uid);
+solver('delete', uid2);
+end
@@ -0,0 +1,27 @@
+function solver_many_test(file)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+m = size(A,1);
+w = rand(4, size(A,2)) + 0.2;
+uid = solver('init', uint64(1234), A);
+solver('decompose', uid, w);
+
+%% solveMany against one solve per right hand side, the c-th one is b(:, (c-1)*m+1:c*m)
+r = 7;
+b = randn(4, m * r);
+x = solver('solveMany', uid, b);
+for c = 1:r
+    idx = (c-1)*m+1:c*m;
+    x2 = solver('solve', uid, b(:, idx));
+    assert(max(abs(x(:, idx) - x2), [], 'all') < 1e-8 * max(abs(x2), [], 'all'));
+end
+
+H = A * diag(sparse(w(4,:))) * A';
+x3 = H \ b(4, 1:m)';
+assert(sum(abs(x(4, 1:m)' - x3)) < 0.01);
+
+solver('delete', uid);
+end
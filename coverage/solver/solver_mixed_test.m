@@ -0,0 +1,32 @@
+function solver_mixed_test(file, method)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+
+%% float factor with refined solves
+uid = solver('init', uint64(1234), A);
+solver('setCholMethod', uid, method);
+solver('setMixedPrecision', uid, 1);
+acc = solver('decompose', uid, w);
+assert(all(acc == 0));
+
+b = randn(4, size(A,1));
+x = solver('solve', uid, b);
+for k = 1:4
+H = A * diag(sparse(w(k,:))) * A';
+x2 = H \ b(k,:)';
+assert(max(abs(x(k,:)' - x2)) < 1e-8 * max(abs(x2)));
+end
+
+%% against the default solver (logdet, L and the leverage scores use the double factor)
+uid2 = solver('init', uint64(1234), A);
+solver('setCholMethod', uid2, method);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A, w);
+solver('delete', uid);
+solver('delete', uid2);
+end
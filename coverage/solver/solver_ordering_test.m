@@ -0,0 +1,42 @@
+function solver_ordering_test(file, ordering, method, postorder)
+if nargin < 3, method = 1; end
+if nargin < 4, postorder = false; end
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+uid = solver('init', uint64(1234), A, ordering, double(postorder));
+solver('setCholMethod', uid, method);
+acc = solver('decompose', uid, w);
+
+%% test L
+L = solver('L', uid, 3);
+H = A * diag(sparse(w(4,:))) * A';
+assert(sum(abs(H - L * L'),'all') < 0.01)
+
+%% test the predicted size of L, including the supernodal padding and the dense block
+r = solver('analyze', uint64(0), A, ordering, double(postorder), method);
+assert(r(2) == nnz(solver('L', uid, 0)));
+
+%% test logdet
+logdet = solver('logdet', uid);
+diagL = solver('diagL', uid);
+logdet2 = sum(log(diagL), 2) * 2;
+assert(all(abs(logdet - logdet2) < 0.01));
+
+%% test lsc
+lsc = solver('leverageScoreComplement', uid, 0);
+corank1 = sum(lsc, 2);
+corank2 = size(A,2)-size(A,1);
+assert(all(abs(corank1 - corank2)<0.01));
+
+%% test solve
+b = randn(4, size(A,1));
+x = solver('solve', uid, b);
+x2 = H \ b(4,:)';
+assert(sum(abs(x(4,:)' - x2)) < 0.01);
+
+solver('delete', uid);
+end
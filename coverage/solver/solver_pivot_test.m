@@ -0,0 +1,48 @@
+function solver_pivot_test()
+solver = @PackedChol4;
+
+% H = A W A' has rank 100 < 150, so at least 50 pivots of each lane are replaced
+rng(1);
+A = sprandn(150, 100, 0.05);
+w = exp(2 * randn(4, size(A,2)));
+uid = solver('init', uint64(1234), A, 1);
+solver('setPivotTolerance', uid, 1e-8);
+[acc, npert] = solver('decompose', uid, w);
+assert(all(npert >= 50));
+
+%% a singular H is not factored accurately, so every lane is refactored in doubledouble
+assert(~any(acc < 0.5)); % NaN if L overflows
+counts = solver('getDecomposeCount', uid);
+assert(all(counts(1:4) == 1));
+solver('delete', uid);
+
+%% H = B W B' + 1e-2 I is nonsingular with cond(H) about 1e8, the null space of B gives tiny pivots
+% solve must return inv(H) b whether a lane is refined, refactored in doubledouble or exact,
+% and logdet and the leverage scores of a refined lane are corrected for the replaced pivots
+B = sprandn(50, 30, 0.3);
+A = [B speye(50)];
+w = [1e6 * exp(randn(4, 30)) 1e-2 * exp(randn(4, 50))];
+b = randn(4, 50);
+uid2 = solver('init', uint64(1234), A);
+solver('setAccuracyTarget', uid2, 0.0);
+solver('decompose', uid2, w);
+logdet2 = solver('logdet', uid2);
+lsc2 = solver('leverageScoreComplement', uid2, 0);
+solver('delete', uid2);
+for tol = [1e-8 2e-9 1.5e-9 1e-10]
+   uid = solver('init', uint64(1234), A);
+   solver('setPivotTolerance', uid, tol);
+   solver('decompose', uid, w);
+   x = solver('solve', uid, b);
+   for k = 1:4
+      H = A * diag(sparse(w(k,:))) * A';
+      x2 = H \ b(k,:)';
+      assert(norm(x(k,:)' - x2, inf) < 1e-5 * norm(x2, inf));
+   end
+   logdet = solver('logdet', uid);
+   assert(all(abs(logdet - logdet2) < 1e-6 * abs(logdet2)));
+   lsc = solver('leverageScoreComplement', uid, 0);
+   assert(max(abs(lsc - lsc2), [], 'all') < 1e-4);
+   solver('delete', uid);
+end
+end
@@ -0,0 +1,28 @@
+function solver_scratch_test(file, method)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+
+%% factors in scratch files against the ones in memory
+uid = solver('init', uint64(1234), A);
+solver('setCholMethod', uid, method);
+solver('setScratchDirectory', uid, tempdir);
+solver('decompose', uid, w);
+
+uid2 = solver('init', uint64(1234), A);
+solver('setCholMethod', uid2, method);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A, w);
+
+%% back in memory
+solver('setScratchDirectory', uid, '');
+solver('decompose', uid, w);
+solver_compare(solver, uid, uid2, A, w);
+
+solver('delete', uid);
+solver('delete', uid2);
+end
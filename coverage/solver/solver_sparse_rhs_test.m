@@ -0,0 +1,28 @@
+function solver_sparse_rhs_test(file)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+m = size(A,1);
+w = rand(4, size(A,2)) + 0.2;
+uid = solver('init', uint64(1234), A);
+solver('decompose', uid, w);
+
+%% solveSparse against one solve per column, the column c of B is the right hand side of all lanes
+B = sprandn(m, 5, 0.02);
+B(:, 1) = 0;
+B(randi(m), 2) = 1;
+x = solver('solveSparse', uid, B);
+for c = 1:size(B,2)
+    idx = (c-1)*m+1:c*m;
+    x2 = solver('solve', uid, repmat(full(B(:, c))', 4, 1));
+    assert(max(abs(x(:, idx) - x2), [], 'all') <= 1e-8 * max(abs(x2), [], 'all'));
+end
+
+H = A * diag(sparse(w(4,:))) * A';
+x3 = H \ full(B(:, 2));
+assert(sum(abs(x(4, m+1:2*m)' - x3)) < 0.01);
+
+solver('delete', uid);
+end
@@ -0,0 +1,39 @@
+function solver_symbolic_test(file)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+b = randn(4, size(A,1));
+path = [tempname '.sym'];
+path2 = [tempname '.sym'];
+
+%% init with a path writes the symbolic analysis
+uid = solver('init', uint64(1234), A, 1, 0, path);
+assert(isfile(path));
+solver('decompose', uid, w);
+x = solver('solve', uid, b);
+logdet = solver('logdet', uid);
+solver('saveSymbolic', uid, path2);
+assert(isfile(path2));
+solver('delete', uid);
+
+%% a new solver loads it once no solver shares the analysis
+for p = {path, path2}
+    uid2 = solver('init', uint64(1234), A, 1, 0, p{1});
+    solver('decompose', uid2, w);
+    x2 = solver('solve', uid2, b);
+    assert(max(abs(x - x2), [], 'all') < 1e-8 * max(abs(x), [], 'all'));
+    logdet2 = solver('logdet', uid2);
+    assert(all(abs(logdet - logdet2) < 0.01));
+    solver('delete', uid2);
+end
+
+H = A * diag(sparse(w(4,:))) * A';
+x3 = H \ b(4,:)';
+assert(sum(abs(x(4,:)' - x3)) < 0.01);
+
+delete(path);
+delete(path2);
+end
@@ -9,3 +9,27 @@ solver_zero_test(false, 0);
 solver_zero_test(false, 4);
 solver_simd_test(matrix_file, false);
 solver_simd_test(matrix_file, true);
+solver_ordering_test(matrix_file, 1);
+solver_ordering_test(matrix_file, 2);
+solver_ordering_test(matrix_file, 2, 2);
+solver_ordering_test(matrix_file, 0, 0, true);
+solver_threads_test(matrix_file, 0);
+solver_threads_test(matrix_file, 1);
+solver_threads_test(matrix_file, 2);
+solver_autotune_test(matrix_file);
+solver_update_test(matrix_file);
+solver_pivot_test();
+solver_symbolic_test(matrix_file);
+solver_components_test(matrix_file, 0);
+solver_components_test(matrix_file, 3);
+solver_scratch_test(matrix_file, 0);
+solver_scratch_test(matrix_file, 1);
+solver_updateA_test(matrix_file);
+solver_many_test(matrix_file);
+solver_sparse_rhs_test(matrix_file);
+solver_assembly_test(matrix_file, 0);
+solver_assembly_test(matrix_file, 1);
+solver_lanegroups_test(matrix_file, 0);
+solver_lanegroups_test(matrix_file, 1);
+solver_mixed_test(matrix_file, 0);
+solver_mixed_test(matrix_file, 1);
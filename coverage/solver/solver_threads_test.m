@@ -0,0 +1,22 @@
+function solver_threads_test(file, method)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+
+%% threaded solver against the default one
+uid = solver('init', uint64(1234), A);
+solver('setCholMethod', uid, method);
+solver('setThreads', uid, 4);
+solver('decompose', uid, w);
+
+uid2 = solver('init', uint64(1234), A);
+solver('setCholMethod', uid2, method);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A, w);
+solver('delete', uid);
+solver('delete', uid2);
+end
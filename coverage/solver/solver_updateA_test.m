@@ -0,0 +1,25 @@
+function solver_updateA_test(file)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+
+% new values with the pattern of A
+[i, j, v] = find(A);
+A2 = sparse(i, j, v .* (0.5 + rand(size(v))), size(A,1), size(A,2));
+
+%% updateA against a solver built for A2
+uid = solver('init', uint64(1234), A);
+solver('decompose', uid, w);
+solver('updateA', uid, A2);
+solver('decompose', uid, w);
+
+uid2 = solver('init', uint64(1234), A2);
+solver('decompose', uid2, w);
+
+solver_compare(solver, uid, uid2, A2, w);
+solver('delete', uid);
+solver('delete', uid2);
+end
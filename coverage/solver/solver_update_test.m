@@ -0,0 +1,35 @@
+function solver_update_test(file)
+solver = @PackedChol4;
+
+load(file);
+A = problem.Aeq;
+A = [A speye(size(A,1))];
+w = rand(4, size(A,2)) + 0.2;
+w2 = w;
+idx = randperm(size(A,2), 5);
+w2(:, idx) = w(:, idx) .* [0.5; 3; 0.5; 3];
+
+%% update from w to w2 against a fresh decompose of w2
+uid = solver('init', uint64(1234), A);
+solver('decompose', uid, w);
+solver('update', uid, w, w2);
+
+uid2 = solver('init', uint64(1234), A);
+solver('decompose', uid2, w2);
+
+b = randn(4, size(A,1));
+x = solver('solve', uid, b);
+x2 = solver('solve', uid2, b);
+assert(max(abs(x - x2), [], 'all') < 1e-6 * max(abs(x2), [], 'all'));
+
+H = A * diag(sparse(w2(4,:))) * A';
+x3 = H \ b(4,:)';
+assert(sum(abs(x(4,:)' - x3)) < 0.01);
+
+logdet = solver('logdet', uid);
+logdet2 = solver('logdet', uid2);
+assert(all(abs(logdet - logdet2) < 0.01));
+
+solver('delete', uid);
+solver('delete', uid2);
+end